@@ -0,0 +1,119 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <cmath>
+#include <vector>
+
+#include "parallel.h"
+#include "profiler.h"
+#include "sophus/interpolate.hpp"
+#include "sophus/se3.hpp"
+
+/**
+ * Motion compensation of a sweep under constant velocity.
+ *
+ * The time of a point within the sweep is its azimuth column (the scanner
+ * rotates at a constant rate), so one pose per column is enough: the poses
+ * are interpolated on SE(3) between the sensor poses at the start and the
+ * end of the sweep and stored as a structure-of-arrays table of float 3x4
+ * coefficients. apply() then moves the points of every row, also stored per
+ * attribute, with fixed-size Eigen array blocks (one column per lane).
+ */
+class Deskew {
+ public:
+  struct Params {
+    // time (fraction of the sweep) the compensated points refer to; KITTI
+    // triggers the cameras when the scanner faces forward (column cols / 2)
+    double reference_time = 0.5;
+  };
+
+  static constexpr int kBlock = 16;
+
+  Deskew() : Deskew(Params()) {}
+  explicit Deskew(const Params &params) : _params(params) {}
+
+  const Params &params() const { return _params; }
+  int cols() const { return _cols; }
+
+  /**
+   * poses of the columns
+   * @param motion sensor motion over one sweep (pose at the end of the sweep
+   *               in the frame at its start)
+   * @param cols azimuth columns of a sweep, in time order
+   */
+  void set_motion(const Sophus::SE3d &motion, int cols) {
+    _cols = cols;
+    for (auto &coefficient : _table) coefficient.resize(size_t(cols));
+    // sensor poses at the start and the end of the sweep in the reference
+    // frame: exp(-reference * log(motion)) and exp((1 - reference) * ...)
+    const Sophus::SE3d start = Sophus::interpolate(
+        Sophus::SE3d(), motion.inverse(), _params.reference_time);
+    // interpolate(start, start * motion, s) with the logarithm taken once
+    const Sophus::SE3d::Tangent xi = motion.log();
+
+    parallel_for(
+        0, size_t(cols),
+        [&](size_t c) {
+          const Sophus::SE3d pose =
+              start * Sophus::SE3d::exp((double(c) + 0.5) / double(cols) * xi);
+          const Eigen::Matrix<float, 3, 4> P = pose.matrix3x4().cast<float>();
+          for (int k = 0; k < 12; k++) _table[size_t(k)][c] = P(k / 4, k % 4);
+        },
+        64);
+  }
+
+  /**
+   * moves every point to the reference time (in place)
+   * @param x, y, z rows x cols() coordinates, row-major
+   * @param range rows x cols() ranges, recomputed for points with range > 0
+   *              (may be null)
+   */
+  void apply(float *x, float *y, float *z, float *range, size_t rows) const {
+    UTILS_PROFILE_SCOPE("deskew");
+    const size_t cols = size_t(_cols);
+    const size_t blocks = cols / kBlock;
+    parallel_for(0, rows, [&](size_t r) {
+      const size_t row = r * cols;
+      for (size_t b = 0; b < blocks; b++) {
+        const size_t c = b * kBlock;
+        transform<Block>(c, Block::Map(x + row + c), Block::Map(y + row + c),
+                         Block::Map(z + row + c),
+                         range ? range + row + c : nullptr);
+      }
+      for (size_t c = blocks * kBlock; c < cols; c++) {
+        using Lane = Eigen::Array<float, 1, 1>;
+        transform<Lane>(c, Lane::Map(x + row + c), Lane::Map(y + row + c),
+                        Lane::Map(z + row + c),
+                        range ? range + row + c : nullptr);
+      }
+    });
+  }
+
+ private:
+  using Block = Eigen::Array<float, kBlock, 1>;
+
+  /** SE3-apply of the columns c .. c + Array::SizeAtCompileTime - 1 */
+  template <class Array>
+  void transform(size_t c, Eigen::Map<Array> x, Eigen::Map<Array> y,
+                 Eigen::Map<Array> z, float *range) const {
+    auto coefficient = [&](int k) {
+      return Eigen::Map<const Array>(&_table[size_t(k)][c]);
+    };
+    const Array px = x, py = y, pz = z;
+    x = coefficient(0) * px + coefficient(1) * py + coefficient(2) * pz +
+        coefficient(3);
+    y = coefficient(4) * px + coefficient(5) * py + coefficient(6) * pz +
+        coefficient(7);
+    z = coefficient(8) * px + coefficient(9) * py + coefficient(10) * pz +
+        coefficient(11);
+    if (range) {
+      Eigen::Map<Array> r(range);
+      r = (r > 0).select((x.square() + y.square() + z.square()).sqrt(), 0.f);
+    }
+  }
+
+  Params _params;
+  int _cols = 0;
+  // row-major 3x4 coefficients of the column poses, one array each
+  std::vector<float> _table[12];
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "laser_scan.h"
+#include "parallel.h"
+#include "profiler.h"
+
+/**
+ * LOAM edge and plane features (C++ version of
+ * python/lidar_odometry/features.py).
+ *
+ * Per ring:
+ * - curvature |sum_{j=-5..5} (p_{i+j} - p_i)|^2, from a sliding window sum in
+ *   O(n) (the ring is closed, as np.roll wraps around)
+ * - the ring is split into 6 sectors; in each sector the points of largest
+ *   curvature above the threshold become edges (2 sharp, 20 less sharp,
+ *   sharp ones included) and those of smallest curvature below it planes (4)
+ * - after each pick, neighbours within 5 indices and closer than
+ *   sqrt(0.05) m are not picked again
+ *
+ * The rings are processed in parallel and the results concatenated in ring
+ * order. Buffers are kept between scans.
+ */
+class FeatureExtractor {
+ public:
+  struct Params {
+    int window = 5;
+    int sectors = 6;
+    int sharp_edges = 2;
+    int less_sharp_edges = 20;
+    int planes = 4;
+    float edge_threshold = 0.1f;
+    float plane_threshold = 0.1f;
+    // squared distance of suppressed neighbours (m^2)
+    float suppression_distance_sq = 0.05f;
+  };
+
+  struct Features {
+    std::vector<Eigen::Vector3f> sharp_edges, less_sharp_edges, planes;
+
+    void clear() {
+      sharp_edges.clear();
+      less_sharp_edges.clear();
+      planes.clear();
+    }
+  };
+
+  FeatureExtractor() : FeatureExtractor(Params()) {}
+  explicit FeatureExtractor(const Params &params)
+      : _params(params), _rings(LaserScan::kRings) {}
+
+  void extract(const LaserScan &scan, Features &features) {
+    UTILS_PROFILE_SCOPE("features");
+    parallel_for(0, LaserScan::kRings,
+                 [&](size_t ring) { extract_ring(scan, int(ring)); });
+
+    features.clear();
+    for (const auto &ring : _rings) {
+      append(features.sharp_edges, ring.features.sharp_edges);
+      append(features.less_sharp_edges, ring.features.less_sharp_edges);
+      append(features.planes, ring.features.planes);
+    }
+  }
+
+ private:
+  struct RingBuffers {
+    std::vector<float> curvature;
+    std::vector<int> order;
+    std::vector<char> edge_picked, plane_picked;
+    Features features;
+  };
+
+  static void append(std::vector<Eigen::Vector3f> &to,
+                     const std::vector<Eigen::Vector3f> &from) {
+    to.insert(to.end(), from.begin(), from.end());
+  }
+
+  void extract_ring(const LaserScan &scan, int r) {
+    RingBuffers &buffers = _rings[size_t(r)];
+    buffers.features.clear();
+    const int n = int(scan.ring_size(r));
+    if (n < 2 * _params.window + 1) return;
+    const Eigen::Vector3f *points = scan.ring(r);
+
+    curvature(points, n, buffers.curvature);
+    buffers.edge_picked.assign(size_t(n), 0);
+    buffers.plane_picked.assign(size_t(n), 0);
+    buffers.order.resize(size_t(n));
+
+    // np.array_split: the first n % sectors sectors get one more point
+    int begin = 0;
+    for (int s = 0; s < _params.sectors; s++) {
+      const int end = begin + n / _params.sectors + (s < n % _params.sectors);
+      select(points, n, begin, end, buffers);
+      begin = end;
+    }
+  }
+
+  /**
+   * |sum_{j=-w..w} p_{i+j} - (2w + 1) p_i|^2 with the window sum updated
+   * point by point
+   */
+  void curvature(const Eigen::Vector3f *points, int n,
+                 std::vector<float> &out) const {
+    const int w = _params.window;
+    out.resize(size_t(n));
+    auto at = [&](int i) -> Eigen::Vector3d {
+      return points[(i % n + n) % n].cast<double>();
+    };
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    for (int j = -w; j <= w; j++) sum += at(j);
+    for (int i = 0; i < n; i++) {
+      out[size_t(i)] = float((sum - (2 * w + 1) * at(i)).squaredNorm());
+      sum += at(i + w + 1) - at(i - w);
+    }
+  }
+
+  void select(const Eigen::Vector3f *points, int n, int begin, int end,
+              RingBuffers &buffers) const {
+    const std::vector<float> &c = buffers.curvature;
+    auto order = buffers.order.begin() + begin;
+    auto order_end = buffers.order.begin() + end;
+    std::iota(order, order_end, begin);
+    // largest curvature first
+    std::sort(order, order_end,
+              [&](int a, int b) { return c[size_t(a)] > c[size_t(b)]; });
+
+    Features &features = buffers.features;
+    int picked = 0;
+    for (auto it = order; it != order_end; ++it) {
+      const int i = *it;
+      if (c[size_t(i)] <= _params.edge_threshold) break;
+      if (buffers.edge_picked[size_t(i)]) continue;
+      if (++picked > _params.less_sharp_edges) break;
+      if (picked <= _params.sharp_edges) {
+        features.sharp_edges.push_back(points[i]);
+      }
+      features.less_sharp_edges.push_back(points[i]);
+      suppress(points, n, i, buffers.edge_picked);
+    }
+
+    picked = 0;
+    for (auto it = order_end; it != order;) {
+      const int i = *--it;
+      if (c[size_t(i)] >= _params.plane_threshold) break;
+      if (buffers.plane_picked[size_t(i)]) continue;
+      features.planes.push_back(points[i]);
+      if (++picked >= _params.planes) break;
+      suppress(points, n, i, buffers.plane_picked);
+    }
+  }
+
+  /** mark the picked point and its close neighbours on the ring */
+  void suppress(const Eigen::Vector3f *points, int n, int i,
+                std::vector<char> &picked) const {
+    picked[size_t(i)] = 1;
+    for (int j = -_params.window; j <= _params.window; j++) {
+      const int k = ((i + j) % n + n) % n;
+      if ((points[k] - points[i]).squaredNorm() <
+          _params.suppression_distance_sq) {
+        picked[size_t(k)] = 1;
+      }
+    }
+  }
+
+  Params _params;
+  std::vector<RingBuffers> _rings;
+};
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "parallel.h"
+
+/**
+ * KD-tree over 3D points for kNN and radius queries.
+ *
+ * - nodes are one contiguous array in depth-first order (the left child
+ *   follows its parent), 16 bytes each
+ * - leaves hold up to kLeafSize points as structure-of-arrays buckets padded
+ *   to kLeafSize, so the distances of a whole leaf are one fixed-size Eigen
+ *   array expression (vectorised, padding lies far away)
+ * - splits at the median of the widest axis; subtrees are built in parallel
+ * - batched queries run across the thread pool and write into caller-owned
+ *   buffers; nothing is allocated per query
+ */
+class KdTree {
+ public:
+  static constexpr int kLeafSize = 16;
+
+  KdTree() = default;
+  explicit KdTree(const std::vector<Eigen::Vector3f> &points) {
+    build(points.data(), points.size());
+  }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  void build(const Eigen::Vector3f *points, size_t count) {
+    _size = count;
+    _nodes.clear();
+    _x.clear();
+    _y.clear();
+    _z.clear();
+    _ids.clear();
+    if (count == 0) return;
+
+    const Shape shape = subtree_shape(count);
+    _nodes.resize(shape.nodes);
+    const size_t slots = shape.leaves * kLeafSize;
+    _x.assign(slots, kFar);
+    _y.assign(slots, kFar);
+    _z.assign(slots, kFar);
+    _ids.assign(slots, -1);
+
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    build_node(points, order.data(), count, 0, 0);
+  }
+
+  /**
+   * k nearest neighbours, closest first
+   * @param indices k entries, -1 after the last neighbour
+   * @param sq_distances k entries
+   * @param max_sq_distance neighbours must be closer than this
+   * @return number of neighbours found
+   */
+  int knn(const Eigen::Vector3f &query, int k, int *indices,
+          float *sq_distances,
+          float max_sq_distance = std::numeric_limits<float>::max()) const {
+    Neighbours result(k, indices, sq_distances, max_sq_distance);
+    if (!_nodes.empty() && k > 0) search(query, result);
+    std::fill(indices + result.size, indices + k, -1);
+    std::fill(sq_distances + result.size, sq_distances + k,
+              std::numeric_limits<float>::max());
+    return result.size;
+  }
+
+  /**
+   * every point within the radius (unsorted)
+   * @param indices cleared and filled; its capacity is reused
+   * @param sq_distances cleared and filled
+   */
+  size_t radius(const Eigen::Vector3f &query, float radius,
+                std::vector<int> &indices,
+                std::vector<float> &sq_distances) const {
+    indices.clear();
+    sq_distances.clear();
+    if (_nodes.empty()) return 0;
+    const float sq_radius = radius * radius;
+    visit(query, [&] { return sq_radius; },
+          [&](int id, float sq_distance) {
+            if (sq_distance <= sq_radius) {
+              indices.push_back(id);
+              sq_distances.push_back(sq_distance);
+            }
+          });
+    return indices.size();
+  }
+
+  /**
+   * knn() of every query in parallel
+   * @param indices n x k, row-major
+   * @param sq_distances n x k, row-major
+   * @param counts n entries (may be null)
+   */
+  void knn_batch(const Eigen::Vector3f *queries, size_t n, int k, int *indices,
+                 float *sq_distances, int *counts = nullptr,
+                 float max_sq_distance =
+                     std::numeric_limits<float>::max()) const {
+    const size_t stride = size_t(std::max(k, 0));
+    parallel_for(
+        0, n,
+        [&](size_t i) {
+          const int found =
+              knn(queries[i], k, indices + i * stride,
+                  sq_distances + i * stride, max_sq_distance);
+          if (counts) counts[i] = found;
+        },
+        kBatchGrain);
+  }
+
+  /**
+   * closest max_results points within the radius of every query, in
+   * parallel (fixed-size output, closest first)
+   * @param indices n x max_results, -1 after the last neighbour
+   * @param sq_distances n x max_results
+   * @param counts n entries (may be null)
+   */
+  void radius_batch(const Eigen::Vector3f *queries, size_t n, float radius,
+                    int max_results, int *indices, float *sq_distances,
+                    int *counts = nullptr) const {
+    // inclusive bound like radius()
+    const float bound = std::nextafter(radius * radius,
+                                       std::numeric_limits<float>::max());
+    knn_batch(queries, n, max_results, indices, sq_distances, counts, bound);
+  }
+
+ private:
+  static constexpr float kFar = 1e18f;
+  static constexpr size_t kBatchGrain = 256;
+  // subtrees larger than this are built on another thread
+  static constexpr size_t kParallelBuild = 1 << 14;
+
+  struct Node {
+    float split;
+    // split axis, -1 for leaves
+    int32_t axis;
+    // inner nodes: index of the right child; leaves: first slot
+    uint32_t first;
+    // leaves: number of points
+    uint32_t count;
+  };
+
+  struct Shape {
+    size_t nodes, leaves;
+  };
+
+  /** nodes and leaves of the subtree of count points (left gets count / 2) */
+  static Shape subtree_shape(size_t count) {
+    if (count <= size_t(kLeafSize)) return {1, 1};
+    const Shape left = subtree_shape(count / 2);
+    const Shape right = subtree_shape(count - count / 2);
+    return {1 + left.nodes + right.nodes, left.leaves + right.leaves};
+  }
+
+  void build_node(const Eigen::Vector3f *points, uint32_t *order,
+                  size_t count, size_t node, size_t leaf) {
+    if (count <= size_t(kLeafSize)) {
+      const size_t first = leaf * kLeafSize;
+      _nodes[node] = {0, -1, uint32_t(first), uint32_t(count)};
+      for (size_t i = 0; i < count; i++) {
+        const Eigen::Vector3f &p = points[order[i]];
+        _x[first + i] = p.x();
+        _y[first + i] = p.y();
+        _z[first + i] = p.z();
+        _ids[first + i] = int(order[i]);
+      }
+      return;
+    }
+
+    // widest axis of the bounding box
+    Eigen::Vector3f lo = points[order[0]], hi = lo;
+    for (size_t i = 1; i < count; i++) {
+      lo = lo.cwiseMin(points[order[i]]);
+      hi = hi.cwiseMax(points[order[i]]);
+    }
+    int axis;
+    (hi - lo).maxCoeff(&axis);
+
+    const size_t half = count / 2;
+    std::nth_element(order, order + half, order + count,
+                     [&](uint32_t a, uint32_t b) {
+                       return points[a][axis] < points[b][axis];
+                     });
+    const Shape left = subtree_shape(half);
+    const size_t right_node = node + 1 + left.nodes;
+    _nodes[node] = {points[order[half]][axis], axis, uint32_t(right_node), 0};
+
+    auto build_left = [&] {
+      build_node(points, order, half, node + 1, leaf);
+    };
+    auto build_right = [&] {
+      build_node(points, order + half, count - half, right_node,
+                 leaf + left.leaves);
+    };
+    if (count > kParallelBuild) {
+      ThreadPool::instance().parallel_for(0, 2, [&](size_t b, size_t e) {
+        for (size_t side = b; side < e; side++) {
+          side == 0 ? build_left() : build_right();
+        }
+      });
+    } else {
+      build_left();
+      build_right();
+    }
+  }
+
+  /** bounded sorted list of the closest points */
+  struct Neighbours {
+    Neighbours(int size_limit, int *index_buffer, float *distance_buffer,
+               float bound)
+        : k(size_limit),
+          indices(index_buffer),
+          sq_distances(distance_buffer),
+          max_sq_distance(bound) {}
+
+    /** distance beyond which points are not accepted */
+    float worst() const {
+      return size == k ? sq_distances[k - 1] : max_sq_distance;
+    }
+    void add(int id, float sq_distance) {
+      if (sq_distance >= worst()) return;
+      int i = size < k ? size++ : k - 1;
+      for (; i > 0 && sq_distances[i - 1] > sq_distance; i--) {
+        sq_distances[i] = sq_distances[i - 1];
+        indices[i] = indices[i - 1];
+      }
+      sq_distances[i] = sq_distance;
+      indices[i] = id;
+    }
+
+    const int k;
+    int *const indices;
+    float *const sq_distances;
+    const float max_sq_distance;
+    int size = 0;
+  };
+
+  void search(const Eigen::Vector3f &query, Neighbours &result) const {
+    visit(query, [&] { return result.worst(); },
+          [&](int id, float sq_distance) { result.add(id, sq_distance); });
+  }
+
+  /**
+   * depth-first traversal, near side first; subtrees whose splitting plane
+   * is farther than bound() are skipped
+   * @param on_point called with every point of the visited leaves
+   */
+  template <class Bound, class OnPoint>
+  void visit(const Eigen::Vector3f &query, Bound &&bound,
+             OnPoint &&on_point) const {
+    using Bucket = Eigen::Array<float, kLeafSize, 1>;
+    // (node, squared distance of its region along the last split)
+    std::pair<uint32_t, float> stack[64];
+    int top = 0;
+    stack[top++] = {0, 0.f};
+    while (top > 0) {
+      const auto [index, plane] = stack[--top];
+      if (plane >= bound()) continue;
+      const Node *node = &_nodes[index];
+      uint32_t current = index;
+      // descend to the leaf on the query side, stacking the far sides
+      while (node->axis >= 0) {
+        const float diff = query[node->axis] - node->split;
+        const uint32_t near = diff < 0 ? current + 1 : node->first;
+        const uint32_t far = diff < 0 ? node->first : current + 1;
+        stack[top++] = {far, diff * diff};
+        current = near;
+        node = &_nodes[current];
+      }
+
+      const size_t first = node->first;
+      const Bucket d =
+          (Eigen::Map<const Bucket>(&_x[first]) - query.x()).square() +
+          (Eigen::Map<const Bucket>(&_y[first]) - query.y()).square() +
+          (Eigen::Map<const Bucket>(&_z[first]) - query.z()).square();
+      for (uint32_t i = 0; i < node->count; i++) {
+        on_point(_ids[first + i], d[Eigen::Index(i)]);
+      }
+    }
+  }
+
+  size_t _size = 0;
+  std::vector<Node> _nodes;
+  // leaf buckets (kLeafSize slots per leaf)
+  std::vector<float> _x, _y, _z;
+  std::vector<int> _ids;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/**
+ * KITTI velodyne scan split into its laser rings (C++ version of
+ * python/lidar_odometry/pcd_io.py pcd2laser).
+ *
+ * The points of ring r are points[offsets[r]] .. points[offsets[r + 1] - 1]
+ * in their original (azimuth) order; the split is a single counting-sort
+ * pass instead of one mask per ring.
+ */
+struct LaserScan {
+  // HDL-64E (config.py n_scans)
+  static constexpr int kRings = 64;
+
+  std::vector<Eigen::Vector3f> points;
+  std::vector<size_t> offsets;
+
+  size_t ring_size(int ring) const {
+    return offsets[size_t(ring) + 1] - offsets[size_t(ring)];
+  }
+  const Eigen::Vector3f *ring(int ring) const {
+    return points.data() + offsets[size_t(ring)];
+  }
+
+  /**
+   * ring of a beam elevation, cf.
+   * https://github.com/HKUST-Aerial-Robotics/A-LOAM/blob/devel/src/scanRegistration.cpp
+   * @return ring in [0, kRings) or -1
+   */
+  static int ring_id(float vertical_deg) {
+    const int ring = vertical_deg >= -8.83f
+                         ? int((2 - vertical_deg) * 3 + 0.5f)
+                         : kRings / 2 + int((-8.83f - vertical_deg) * 2 + 0.5f);
+    return 0 <= ring && ring < kRings ? ring : -1;
+  }
+
+  /**
+   * @param xyzi points as in the velodyne .bin files (x, y, z, reflectance)
+   * @param count number of points
+   * @param minimum_range points closer to the sensor are dropped (config.py)
+   */
+  void assign(const float *xyzi, size_t count, float minimum_range = 0.1f) {
+    _rings.resize(count);
+    offsets.assign(kRings + 1, 0);
+    const float min_sq = minimum_range * minimum_range;
+    for (size_t i = 0; i < count; i++) {
+      const float *p = xyzi + 4 * i;
+      const float r_xy_sq = p[0] * p[0] + p[1] * p[1];
+      int ring = -1;
+      if (r_xy_sq + p[2] * p[2] > min_sq) {
+        const float vertical = std::atan2(p[2], std::sqrt(r_xy_sq));
+        ring = ring_id(float(vertical * 180 / M_PI));
+      }
+      _rings[i] = ring;
+      if (ring >= 0) offsets[size_t(ring) + 1]++;
+    }
+    for (int r = 0; r < kRings; r++) {
+      offsets[size_t(r) + 1] += offsets[size_t(r)];
+    }
+
+    points.resize(offsets[kRings]);
+    _cursor.assign(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < count; i++) {
+      if (_rings[i] < 0) continue;
+      const float *p = xyzi + 4 * i;
+      points[_cursor[size_t(_rings[i])]++] = Eigen::Vector3f(p[0], p[1], p[2]);
+    }
+  }
+
+ private:
+  // buffers reused between scans
+  std::vector<int> _rings;
+  std::vector<size_t> _cursor;
+};
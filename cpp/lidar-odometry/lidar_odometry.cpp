@@ -0,0 +1,160 @@
+/**
+ * LiDAR odometry on KITTI velodyne scans
+ * (C++ version of python/lidar_odometry).
+ */
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "deskew.h"
+#include "feature_extractor.h"
+#include "laser_scan.h"
+#include "profiler.h"
+#include "range_image.h"
+#include "registration.h"
+#include "scan_context.h"
+#include "velodyne_reader.h"
+#include "voxel_grid.h"
+#include "voxel_map.h"
+
+using namespace std;
+
+// python/lidar_odometry/config.py
+const string root_path = "/mnt/d/datasets/KITTI/odometry/sequences";
+const string sequence_num = "00";
+// scans mapped ahead of processing
+const size_t PREFETCH_SCANS = 4;
+// the range image is downsampled to one point per voxel for registration
+const float ICP_VOXEL_SIZE = 1.0f;
+// poses of the scans (KITTI format)
+const string output_path = "lidar_poses.txt";
+// loop closure candidates (scan, matched scan, distance, yaw)
+const string loop_path = "lidar_loops.txt";
+// per-stage latency report (<prefix>.json, .csv and .trace.json)
+const string profile_prefix = "profile_lidar";
+
+int main(int argc, char **argv) {
+  // lidar_odometry [sequence path] [first] [last]
+  const string sequence_path =
+      argc > 1 ? argv[1] : root_path + "/" + sequence_num;
+  const int first = argc > 2 ? stoi(argv[2]) : 0;
+  const int last = argc > 3 ? stoi(argv[3]) : 1000000;
+
+  VelodyneReader reader(sequence_path, first, last, PREFETCH_SCANS);
+  VelodyneScan velodyne;
+  RangeImage range_image;
+  LaserScan scan;
+  FeatureExtractor extractor;
+  FeatureExtractor::Features features;
+  size_t num_scans = 0, num_sharp = 0, num_less_sharp = 0, num_planes = 0;
+  size_t num_points = 0, num_ground = 0;
+
+  // scan-to-map registration with a constant-velocity guess; the map keeps
+  // the registered scans around the sensor
+  VoxelGrid voxel_grid({ICP_VOXEL_SIZE, VoxelGrid::Mode::Centroid});
+  VoxelMap map;
+  Registration registration;
+  registration.set_target(map);
+  vector<Eigen::Vector3f> source, registered;
+  Sophus::SE3d pose, motion;
+  // points are moved to the middle of the sweep with the previous motion
+  Deskew deskew;
+  double icp_ms = 0;
+  ofstream poses(output_path);
+
+  // place recognition against the earlier scans
+  ScanContext scan_context;
+  ScanContext::Descriptor descriptor;
+  size_t num_loops = 0;
+  ofstream loops(loop_path);
+
+  const auto begin = chrono::steady_clock::now();
+  for (;;) {
+    UTILS_PROFILE_SCOPE("scan");
+    {
+      UTILS_PROFILE_SCOPE("load");
+      if (!reader.next(velodyne)) break;
+    }
+    // rings come from the range image (closest point per azimuth bin)
+    range_image.build(velodyne.xyzi(), velodyne.size());
+    if (num_scans > 0) {
+      deskew.set_motion(motion, range_image.cols());
+      range_image.deskew(deskew);
+    }
+    range_image.to_scan(scan);
+    extractor.extract(scan, features);
+
+    voxel_grid.filter(scan.points, source);
+    if (num_scans > 0) {
+      const Sophus::SE3d previous = pose;
+      pose = registration.align(source, pose * motion);
+      motion = previous.inverse() * pose;
+      icp_ms += registration.stats().total_ms;
+    }
+    {
+      // the full scan goes into the map: the downsampled one leaves too few
+      // points per voxel for its plane
+      const Eigen::Matrix3f R = pose.rotationMatrix().cast<float>();
+      const Eigen::Vector3f t = pose.translation().cast<float>();
+      registered.resize(scan.points.size());
+      for (size_t i = 0; i < scan.points.size(); i++) {
+        registered[i] = R * scan.points[i] + t;
+      }
+      map.update(registered, t);
+    }
+    const Eigen::Matrix<double, 3, 4> P = pose.matrix3x4();
+    for (int i = 0; i < 12; i++) {
+      poses << P(i / 4, i % 4) << (i < 11 ? " " : "\n");
+    }
+
+    scan_context.describe(scan.points, descriptor);
+    const ScanContext::Match loop = scan_context.query(descriptor);
+    if (loop.index >= 0) {
+      loops << num_scans << " " << loop.index << " " << loop.distance << " "
+            << loop.yaw << "\n";
+      num_loops++;
+    }
+    scan_context.add(descriptor);
+
+    num_scans++;
+    num_sharp += features.sharp_edges.size();
+    num_less_sharp += features.less_sharp_edges.size();
+    num_planes += features.planes.size();
+    num_points += scan.points.size();
+    num_ground += size_t(std::count(range_image.ground_mask().begin(),
+                                    range_image.ground_mask().end(), 1));
+  }
+  const double elapsed_secs =
+      chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  if (num_scans == 0) {
+    cerr << "No scans in " << sequence_path << "/velodyne" << endl;
+    return 1;
+  }
+
+  cout << num_scans << " scans, " << double(num_scans) / elapsed_secs
+       << " scans/s" << endl;
+  cout << "Features/scan: " << num_sharp / num_scans << " sharp edges, "
+       << num_less_sharp / num_scans << " less sharp edges, "
+       << num_planes / num_scans << " planes" << endl;
+  cout << "Range image: " << num_points / num_scans << " points/scan, "
+       << 100.0 * double(num_ground) / double(max<size_t>(num_points, 1))
+       << " % ground" << endl;
+  if (num_scans > 1) {
+    cout << "ICP average: " << icp_ms / double(num_scans - 1) << " ms/scan"
+         << endl;
+    cout << "Last scan ";
+    registration.stats().print();
+    cout << "Map: " << map.num_voxels() << " voxels, " << map.num_points()
+         << " points" << endl;
+  }
+  cout << "Poses written to " << output_path << endl;
+  cout << num_loops << " loop closures written to " << loop_path << endl;
+
+  utils::Profiler::instance().report();
+  utils::Profiler::instance().write_all(profile_prefix);
+
+  return 0;
+}
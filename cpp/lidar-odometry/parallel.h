@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Process-wide pool of worker threads for the data-parallel LiDAR kernels
+ * (one task per ring, per query batch, ...).
+ *
+ * parallel_for() hands out chunks of the index range through an atomic
+ * counter; the calling thread takes chunks as well and returns once every
+ * chunk has completed, so nested calls from inside a worker cannot deadlock
+ * even when all workers are busy.
+ */
+class ThreadPool {
+ public:
+  static ThreadPool &instance() {
+    static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u));
+    return pool;
+  }
+
+  explicit ThreadPool(unsigned threads) {
+    // the caller of parallel_for() is one of the threads
+    for (unsigned i = 1; i < threads; i++) {
+      _workers.emplace_back([this] { work(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (auto &worker : _workers) worker.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /** number of threads including the caller */
+  size_t size() const { return _workers.size() + 1; }
+
+  /**
+   * body(begin, end) on chunks of [begin, end)
+   * @param grain indices per chunk
+   */
+  void parallel_for(size_t begin, size_t end,
+                    const std::function<void(size_t, size_t)> &body,
+                    size_t grain = 1) {
+    if (begin >= end) return;
+    grain = std::max<size_t>(grain, 1);
+    const size_t chunks = (end - begin + grain - 1) / grain;
+    if (chunks == 1 || _workers.empty()) {
+      body(begin, end);
+      return;
+    }
+
+    auto job = std::make_shared<Job>(begin, end, grain, body);
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      const size_t helpers = std::min(chunks - 1, _workers.size());
+      for (size_t i = 0; i < helpers; i++) _queue.push_back(job);
+    }
+    _cv.notify_all();
+
+    job->run();
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&] { return job->done == end - begin; });
+  }
+
+ private:
+  struct Job {
+    Job(size_t first, size_t last, size_t chunk,
+        const std::function<void(size_t, size_t)> &function)
+        : next(first), end(last), grain(chunk), body(function) {}
+
+    /** take chunks until none is left */
+    void run() {
+      for (;;) {
+        const size_t b = next.fetch_add(grain);
+        if (b >= end) return;
+        const size_t e = std::min(b + grain, end);
+        body(b, e);
+        std::lock_guard<std::mutex> lock(mutex);
+        done += e - b;
+        if (next >= end) finished.notify_all();
+      }
+    }
+
+    std::atomic<size_t> next;
+    const size_t end, grain;
+    // only called while chunks are left, i.e. before parallel_for() returns
+    const std::function<void(size_t, size_t)> &body;
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t done = 0;
+  };
+
+  void work() {
+    for (;;) {
+      std::shared_ptr<Job> job;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this] { return _stop || !_queue.empty(); });
+        if (_stop) return;
+        job = std::move(_queue.front());
+        _queue.pop_front();
+      }
+      job->run();
+    }
+  }
+
+  std::vector<std::thread> _workers;
+  std::deque<std::shared_ptr<Job>> _queue;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stop = false;
+};
+
+/** ThreadPool::instance().parallel_for() with body(i) per index */
+template <class Body>
+void parallel_for(size_t begin, size_t end, Body &&body, size_t grain = 1) {
+  ThreadPool::instance().parallel_for(
+      begin, end,
+      [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; i++) body(i);
+      },
+      grain);
+}
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define POINT_CLOUD_AVX2 1
+#else
+#define POINT_CLOUD_AVX2 0
+#endif
+
+/**
+ * Point cloud stored per attribute (x, y, z, intensity).
+ *
+ * The attributes are the rows of one 64-byte aligned buffer, stride()
+ * floats apart, so a kernel on the coordinates reads three dense streams
+ * instead of padded pcl::PointXYZI structs, and xyz() / row() are Eigen
+ * views of the buffer (no copy). The range filter, the box crop, the rigid
+ * transform and the moments run on 8 points per AVX2 instruction when the
+ * build enables it (-march=native) and as scalar loops otherwise; filters
+ * compact the kept points with one permutation per 8 points.
+ *
+ * Views and pointers are invalidated when the cloud grows past capacity().
+ */
+class PointCloud {
+ public:
+  enum Attribute { X = 0, Y, Z, Intensity, kAttributes };
+
+  static constexpr size_t kAlignment = 64;
+  // rows are padded to this many floats (keeps every row aligned)
+  static constexpr size_t kRowAlignment = kAlignment / sizeof(float);
+
+  using Matrix3X = Eigen::Matrix<float, 3, Eigen::Dynamic, Eigen::RowMajor>;
+  using Xyz = Eigen::Map<Matrix3X, Eigen::Aligned64, Eigen::OuterStride<>>;
+  using ConstXyz =
+      Eigen::Map<const Matrix3X, Eigen::Aligned64, Eigen::OuterStride<>>;
+  using Row = Eigen::Map<Eigen::VectorXf, Eigen::Aligned64>;
+  using ConstRow = Eigen::Map<const Eigen::VectorXf, Eigen::Aligned64>;
+
+  PointCloud() = default;
+  explicit PointCloud(size_t size) { resize(size); }
+  PointCloud(const PointCloud &other) { *this = other; }
+  PointCloud(PointCloud &&other) noexcept { *this = std::move(other); }
+
+  PointCloud &operator=(const PointCloud &other) {
+    if (this == &other) return *this;
+    resize(other._size);
+    for (int a = 0; a < kAttributes; a++) {
+      std::copy_n(other.data(Attribute(a)), _size, data(Attribute(a)));
+    }
+    return *this;
+  }
+  PointCloud &operator=(PointCloud &&other) noexcept {
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    std::swap(_stride, other._stride);
+    return *this;
+  }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  /** floats between the attribute rows (= capacity) */
+  size_t stride() const { return _stride; }
+  size_t capacity() const { return _stride; }
+
+  float *data(Attribute a) { return _data.get() + size_t(a) * _stride; }
+  const float *data(Attribute a) const {
+    return _data.get() + size_t(a) * _stride;
+  }
+  float *x() { return data(X); }
+  float *y() { return data(Y); }
+  float *z() { return data(Z); }
+  float *intensity() { return data(Intensity); }
+  const float *x() const { return data(X); }
+  const float *y() const { return data(Y); }
+  const float *z() const { return data(Z); }
+  const float *intensity() const { return data(Intensity); }
+
+  Eigen::Vector3f point(size_t i) const {
+    return Eigen::Vector3f(x()[i], y()[i], z()[i]);
+  }
+
+  /** 3 x size() view of the coordinates */
+  Xyz xyz() {
+    return Xyz(_data.get(), 3, Eigen::Index(_size),
+               Eigen::OuterStride<>(Eigen::Index(_stride)));
+  }
+  ConstXyz xyz() const {
+    return ConstXyz(_data.get(), 3, Eigen::Index(_size),
+                    Eigen::OuterStride<>(Eigen::Index(_stride)));
+  }
+  /** one attribute as a vector */
+  Row row(Attribute a) { return Row(data(a), Eigen::Index(_size)); }
+  ConstRow row(Attribute a) const {
+    return ConstRow(data(a), Eigen::Index(_size));
+  }
+
+  void reserve(size_t capacity) {
+    if (capacity <= _stride) return;
+    const size_t stride =
+        (capacity + kRowAlignment - 1) / kRowAlignment * kRowAlignment;
+    Buffer buffer(static_cast<float *>(std::aligned_alloc(
+        kAlignment, size_t(kAttributes) * stride * sizeof(float))));
+    if (!buffer) throw std::bad_alloc();
+    for (int a = 0; a < kAttributes; a++) {
+      std::copy_n(data(Attribute(a)), _size, buffer.get() + size_t(a) * stride);
+    }
+    _data = std::move(buffer);
+    _stride = stride;
+  }
+  /** new points are uninitialised; the capacity is kept when shrinking */
+  void resize(size_t size) {
+    reserve(size);
+    _size = size;
+  }
+  void clear() { _size = 0; }
+
+  void push_back(const Eigen::Vector3f &p, float intensity = 0) {
+    if (_size == _stride) reserve(std::max<size_t>(2 * _stride, 1024));
+    x()[_size] = p.x();
+    y()[_size] = p.y();
+    z()[_size] = p.z();
+    data(Intensity)[_size] = intensity;
+    _size++;
+  }
+
+  /**
+   * @param xyzi points as in the velodyne .bin files (x, y, z, reflectance)
+   * @param count number of points
+   */
+  void assign(const float *xyzi, size_t count) {
+    resize(count);
+    float *px = x(), *py = y(), *pz = z(), *pi = intensity();
+    for (size_t i = 0; i < count; i++) {
+      px[i] = xyzi[4 * i];
+      py[i] = xyzi[4 * i + 1];
+      pz[i] = xyzi[4 * i + 2];
+      pi[i] = xyzi[4 * i + 3];
+    }
+  }
+
+  /**
+   * copy from a pcl::PointCloud (or any container of points with x, y, z);
+   * intensities are set to 0
+   */
+  template <class Cloud>
+  void assign(const Cloud &cloud) {
+    resize(cloud.size());
+    for (size_t i = 0; i < _size; i++) {
+      x()[i] = cloud[i].x;
+      y()[i] = cloud[i].y;
+      z()[i] = cloud[i].z;
+      data(Intensity)[i] = 0;
+    }
+  }
+
+  /** copy into a pcl::PointCloud of any point type with x, y, z */
+  template <class Cloud>
+  void to_cloud(Cloud &cloud) const {
+    cloud.resize(_size);
+    for (size_t i = 0; i < _size; i++) {
+      cloud[i].x = x()[i];
+      cloud[i].y = y()[i];
+      cloud[i].z = z()[i];
+    }
+  }
+
+  /**
+   * points with min_range <= |p| <= max_range
+   * @param out may be this cloud
+   */
+  void filter_range(float min_range, float max_range, PointCloud &out) const {
+    select(out, RangeTest(min_range, max_range));
+  }
+
+  /**
+   * points inside the box [min, max] (outside if negative)
+   * @param out may be this cloud
+   */
+  void crop_box(const Eigen::Vector3f &min, const Eigen::Vector3f &max,
+                PointCloud &out, bool negative = false) const {
+    select(out, BoxTest(min, max, negative));
+  }
+
+  /** p <- R p + t in place */
+  void transform(const Eigen::Matrix3f &R, const Eigen::Vector3f &t) {
+    float *px = x(), *py = y(), *pz = z();
+    size_t i = 0;
+#if POINT_CLOUD_AVX2
+    __m256 r[9], s[3];
+    for (int k = 0; k < 9; k++) r[k] = _mm256_set1_ps(R(k / 3, k % 3));
+    for (int k = 0; k < 3; k++) s[k] = _mm256_set1_ps(t[k]);
+    for (; i + kLanes <= _size; i += kLanes) {
+      const __m256 vx = _mm256_load_ps(px + i), vy = _mm256_load_ps(py + i),
+                   vz = _mm256_load_ps(pz + i);
+      for (int k = 0; k < 3; k++) {
+        const __m256 v = _mm256_fmadd_ps(
+            r[3 * k], vx,
+            _mm256_fmadd_ps(r[3 * k + 1], vy,
+                            _mm256_fmadd_ps(r[3 * k + 2], vz, s[k])));
+        _mm256_store_ps(data(Attribute(k)) + i, v);
+      }
+    }
+#endif
+    for (; i < _size; i++) {
+      const Eigen::Vector3f p = R * point(i) + t;
+      px[i] = p.x();
+      py[i] = p.y();
+      pz[i] = p.z();
+    }
+  }
+
+  Eigen::Vector3d centroid() const {
+    Eigen::Vector3d mean;
+    moments<false>(mean, nullptr);
+    return mean;
+  }
+
+  /** centroid and covariance (normalised by size()) */
+  void covariance(Eigen::Vector3d &mean, Eigen::Matrix3d &covariance) const {
+    moments<true>(mean, &covariance);
+  }
+
+ private:
+  struct Free {
+    void operator()(float *p) const { std::free(p); }
+  };
+  using Buffer = std::unique_ptr<float[], Free>;
+
+  static constexpr size_t kLanes = 8;
+
+#if POINT_CLOUD_AVX2
+  struct Lanes {
+    explicit Lanes(const Eigen::Vector3f &v)
+        : x(_mm256_set1_ps(v.x())),
+          y(_mm256_set1_ps(v.y())),
+          z(_mm256_set1_ps(v.z())) {}
+    __m256 x, y, z;
+  };
+#endif
+
+  /** predicates of select() on one point and, with AVX2, on 8 (as a mask) */
+  struct RangeTest {
+    RangeTest(float min_range, float max_range)
+        : min_sq(min_range * min_range), max_sq(max_range * max_range) {}
+    bool operator()(float px, float py, float pz) const {
+      const float sq = px * px + py * py + pz * pz;
+      return min_sq <= sq && sq <= max_sq;
+    }
+#if POINT_CLOUD_AVX2
+    __m256 operator()(__m256 px, __m256 py, __m256 pz) const {
+      const __m256 sq = _mm256_fmadd_ps(
+          px, px, _mm256_fmadd_ps(py, py, _mm256_mul_ps(pz, pz)));
+      return _mm256_and_ps(
+          _mm256_cmp_ps(_mm256_set1_ps(min_sq), sq, _CMP_LE_OQ),
+          _mm256_cmp_ps(sq, _mm256_set1_ps(max_sq), _CMP_LE_OQ));
+    }
+#endif
+    float min_sq, max_sq;
+  };
+
+  struct BoxTest {
+    BoxTest(const Eigen::Vector3f &min, const Eigen::Vector3f &max,
+            bool outside)
+        : lo(min), hi(max), negative(outside) {}
+    bool operator()(float px, float py, float pz) const {
+      const bool inside = lo.x() <= px && px <= hi.x() && lo.y() <= py &&
+                          py <= hi.y() && lo.z() <= pz && pz <= hi.z();
+      return inside != negative;
+    }
+#if POINT_CLOUD_AVX2
+    __m256 operator()(__m256 px, __m256 py, __m256 pz) const {
+      const Lanes l(lo), h(hi);
+      __m256 inside = _mm256_and_ps(_mm256_cmp_ps(l.x, px, _CMP_LE_OQ),
+                                    _mm256_cmp_ps(px, h.x, _CMP_LE_OQ));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(l.y, py, _CMP_LE_OQ));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(py, h.y, _CMP_LE_OQ));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(l.z, pz, _CMP_LE_OQ));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(pz, h.z, _CMP_LE_OQ));
+      const __m256 flip =
+          _mm256_castsi256_ps(_mm256_set1_epi32(negative ? -1 : 0));
+      return _mm256_xor_ps(inside, flip);
+    }
+#endif
+    Eigen::Vector3f lo, hi;
+    bool negative;
+  };
+
+#if POINT_CLOUD_AVX2
+  /** permutation moving the lanes set in a movemask to the front */
+  static __m256i compaction(int mask) {
+    struct Table {
+      Table() {
+        for (int m = 0; m < 256; m++) {
+          int n = 0;
+          for (int lane = 0; lane < 8; lane++) {
+            if (m & (1 << lane)) rows[m][n++] = lane;
+          }
+          while (n < 8) rows[m][n++] = 0;
+        }
+      }
+      alignas(32) int32_t rows[256][8];
+    };
+    static const Table table;
+    return _mm256_load_si256(
+        reinterpret_cast<const __m256i *>(table.rows[mask]));
+  }
+
+  /** sum of the 4 lanes */
+  static double sum(__m256d v) {
+    const __m128d pair =
+        _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+  }
+#endif
+
+  /** copies the points passing test (in order) into out */
+  template <class Test>
+  void select(PointCloud &out, const Test &test) const {
+    // writes never pass the read position, so out may be this cloud
+    out.resize(_size);
+    size_t n = 0, i = 0;
+#if POINT_CLOUD_AVX2
+    for (; i + kLanes <= _size; i += kLanes) {
+      const int mask = _mm256_movemask_ps(test(_mm256_load_ps(x() + i),
+                                                  _mm256_load_ps(y() + i),
+                                                  _mm256_load_ps(z() + i)));
+      if (mask == 0) continue;
+      const __m256i permutation = compaction(mask);
+      for (int a = 0; a < kAttributes; a++) {
+        const __m256 v = _mm256_load_ps(data(Attribute(a)) + i);
+        _mm256_storeu_ps(out.data(Attribute(a)) + n,
+                         _mm256_permutevar8x32_ps(v, permutation));
+      }
+      n += size_t(__builtin_popcount(unsigned(mask)));
+    }
+#endif
+    for (; i < _size; i++) {
+      if (!test(x()[i], y()[i], z()[i])) continue;
+      for (int a = 0; a < kAttributes; a++) {
+        out.data(Attribute(a))[n] = data(Attribute(a))[i];
+      }
+      n++;
+    }
+    out._size = n;
+  }
+
+  /**
+   * first and (kSecond) second moments, accumulated in double relative to
+   * the first point to avoid cancellation far from the origin
+   */
+  template <bool kSecond>
+  void moments(Eigen::Vector3d &mean, Eigen::Matrix3d *covariance) const {
+    mean.setZero();
+    if (covariance) covariance->setZero();
+    if (_size == 0) return;
+    const Eigen::Vector3f origin = point(0);
+    // x, y, z, xx, xy, xz, yy, yz, zz
+    double sums[9] = {};
+    size_t i = 0;
+#if POINT_CLOUD_AVX2
+    __m256d acc[9];
+    for (auto &a : acc) a = _mm256_setzero_pd();
+    const Lanes o(origin);
+    for (; i + kLanes <= _size; i += kLanes) {
+      const __m256 d[3] = {_mm256_sub_ps(_mm256_load_ps(x() + i), o.x),
+                           _mm256_sub_ps(_mm256_load_ps(y() + i), o.y),
+                           _mm256_sub_ps(_mm256_load_ps(z() + i), o.z)};
+      for (int half = 0; half < 2; half++) {
+        __m256d v[3];
+        for (int k = 0; k < 3; k++) {
+          v[k] = _mm256_cvtps_pd(half == 0 ? _mm256_castps256_ps128(d[k])
+                                           : _mm256_extractf128_ps(d[k], 1));
+          acc[k] = _mm256_add_pd(acc[k], v[k]);
+        }
+        if (kSecond) {
+          acc[3] = _mm256_fmadd_pd(v[0], v[0], acc[3]);
+          acc[4] = _mm256_fmadd_pd(v[0], v[1], acc[4]);
+          acc[5] = _mm256_fmadd_pd(v[0], v[2], acc[5]);
+          acc[6] = _mm256_fmadd_pd(v[1], v[1], acc[6]);
+          acc[7] = _mm256_fmadd_pd(v[1], v[2], acc[7]);
+          acc[8] = _mm256_fmadd_pd(v[2], v[2], acc[8]);
+        }
+      }
+    }
+    for (int k = 0; k < 9; k++) sums[k] = sum(acc[k]);
+#endif
+    for (; i < _size; i++) {
+      const Eigen::Vector3d d = (point(i) - origin).cast<double>();
+      sums[0] += d.x();
+      sums[1] += d.y();
+      sums[2] += d.z();
+      if (kSecond) {
+        sums[3] += d.x() * d.x();
+        sums[4] += d.x() * d.y();
+        sums[5] += d.x() * d.z();
+        sums[6] += d.y() * d.y();
+        sums[7] += d.y() * d.z();
+        sums[8] += d.z() * d.z();
+      }
+    }
+
+    const double n = double(_size);
+    const Eigen::Vector3d shift(sums[0] / n, sums[1] / n, sums[2] / n);
+    mean = origin.cast<double>() + shift;
+    if (kSecond) {
+      Eigen::Matrix3d &C = *covariance;
+      C << sums[3], sums[4], sums[5], sums[4], sums[6], sums[7], sums[5],
+          sums[7], sums[8];
+      C = C / n - shift * shift.transpose();
+    }
+  }
+
+  Buffer _data;
+  size_t _size = 0, _stride = 0;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "deskew.h"
+#include "laser_scan.h"
+#include "parallel.h"
+#include "profiler.h"
+
+/**
+ * Organised view of a velodyne scan: one row per laser ring (LaserScan
+ * ring IDs, row 0 at the top) and one column per azimuth bin.
+ *
+ * Built in a single pass over the raw points; each pixel keeps the closest
+ * point falling into it. Pixel data is stored per attribute (range, x, y, z,
+ * source index), neighbours are plain index arithmetic (columns wrap around,
+ * rows do not), and row kernels run in parallel. Invalid pixels have range 0;
+ * ground pixels are found column by column from the lowest ring upwards by
+ * the slope between vertically adjacent points.
+ */
+class RangeImage {
+ public:
+  struct Params {
+    int cols = 2048;
+    float minimum_range = 0.1f;
+    // maximum slope between ground points of adjacent rings (deg)
+    float ground_slope_deg = 10;
+    // ground is searched from the lowest ring up to this row
+    int ground_top_row = 40;
+  };
+
+  static constexpr int kRows = LaserScan::kRings;
+
+  RangeImage() : RangeImage(Params()) {}
+  explicit RangeImage(const Params &params)
+      : _params(params),
+        _range(size(), 0),
+        _x(size()),
+        _y(size()),
+        _z(size()),
+        _index(size(), -1),
+        _ground(size(), 0) {}
+
+  int cols() const { return _params.cols; }
+  size_t size() const { return size_t(kRows) * size_t(_params.cols); }
+  size_t pixel(int r, int c) const {
+    return size_t(r) * size_t(_params.cols) + size_t(c);
+  }
+
+  /** column of an azimuth bin with wrap-around */
+  int wrap(int c) const {
+    return (c % _params.cols + _params.cols) % _params.cols;
+  }
+  /**
+   * pixel at (r + dr, c + dc)
+   * @return -1 above the top or below the bottom ring
+   */
+  long neighbour(int r, int c, int dr, int dc) const {
+    const int nr = r + dr;
+    if (nr < 0 || nr >= kRows) return -1;
+    return long(pixel(nr, wrap(c + dc)));
+  }
+
+  bool valid(size_t p) const { return _range[p] > 0; }
+  bool ground(size_t p) const { return _ground[p] != 0; }
+  float range(size_t p) const { return _range[p]; }
+  Eigen::Vector3f point(size_t p) const {
+    return Eigen::Vector3f(_x[p], _y[p], _z[p]);
+  }
+  /** index of the source point (-1 if invalid) */
+  int index(size_t p) const { return _index[p]; }
+
+  /** per-attribute arrays, row-major */
+  const std::vector<float> &ranges() const { return _range; }
+  const std::vector<float> &xs() const { return _x; }
+  const std::vector<float> &ys() const { return _y; }
+  const std::vector<float> &zs() const { return _z; }
+  /** 1 for ground pixels */
+  const std::vector<uint8_t> &ground_mask() const { return _ground; }
+
+  /**
+   * rings of the valid pixels in azimuth order, for FeatureExtractor
+   * (ring IDs are the rows)
+   */
+  void to_scan(LaserScan &scan) const {
+    scan.offsets.assign(kRows + 1, 0);
+    for (int r = 0; r < kRows; r++) {
+      size_t n = 0;
+      for (int c = 0; c < _params.cols; c++) n += valid(pixel(r, c));
+      scan.offsets[size_t(r) + 1] = scan.offsets[size_t(r)] + n;
+    }
+    scan.points.resize(scan.offsets[kRows]);
+    for_each_row([&](int r) {
+      size_t i = scan.offsets[size_t(r)];
+      for (int c = 0; c < _params.cols; c++) {
+        const size_t p = pixel(r, c);
+        if (valid(p)) scan.points[i++] = point(p);
+      }
+    });
+  }
+
+  /**
+   * motion compensation of every pixel (the columns are the sweep's time
+   * order)
+   * @param deskew poses of cols() columns
+   */
+  void deskew(const Deskew &deskew) {
+    deskew.apply(_x.data(), _y.data(), _z.data(), _range.data(), kRows);
+  }
+
+  /** kernel(row) on every row in parallel */
+  template <class Kernel>
+  void for_each_row(Kernel &&kernel) const {
+    parallel_for(0, kRows, [&](size_t r) { kernel(int(r)); });
+  }
+
+  /**
+   * @param xyzi points as in the velodyne .bin files (x, y, z, reflectance)
+   * @param count number of points
+   */
+  void build(const float *xyzi, size_t count) {
+    UTILS_PROFILE_SCOPE("range-image");
+    const int cols = _params.cols;
+    parallel_for(0, kRows, [&](size_t r) {
+      const size_t begin = pixel(int(r), 0);
+      std::fill(&_range[begin], &_range[begin] + cols, 0.f);
+      std::fill(&_index[begin], &_index[begin] + cols, -1);
+    });
+
+    const float min_range = _params.minimum_range;
+    const float bins_per_rad = float(cols / (2 * M_PI));
+    for (size_t i = 0; i < count; i++) {
+      const float *p = xyzi + 4 * i;
+      const float r_xy = std::sqrt(p[0] * p[0] + p[1] * p[1]);
+      const float range = std::sqrt(r_xy * r_xy + p[2] * p[2]);
+      if (range <= min_range) continue;
+      const int r =
+          LaserScan::ring_id(float(std::atan2(p[2], r_xy) * 180 / M_PI));
+      if (r < 0) continue;
+      // azimuth pi at column 0, increasing clockwise like the sweep
+      int c = int((float(M_PI) - std::atan2(p[1], p[0])) * bins_per_rad);
+      if (c >= cols) c -= cols;
+      const size_t q = pixel(r, c);
+      if (_range[q] > 0 && _range[q] <= range) continue;
+      _range[q] = range;
+      _x[q] = p[0];
+      _y[q] = p[1];
+      _z[q] = p[2];
+      _index[q] = int(i);
+    }
+
+    mark_ground();
+  }
+
+ private:
+  /** column-parallel ground labelling */
+  void mark_ground() {
+    const float max_slope =
+        float(std::tan(_params.ground_slope_deg * M_PI / 180));
+    std::fill(_ground.begin(), _ground.end(), 0);
+    parallel_for(
+        0, size_t(_params.cols),
+        [&](size_t c) {
+          // lower valid point of the current pair
+          long lower = -1;
+          for (int r = kRows - 1; r >= _params.ground_top_row; r--) {
+            const size_t p = pixel(r, int(c));
+            if (!valid(p)) continue;
+            if (lower >= 0) {
+              const size_t q = size_t(lower);
+              const float dx = _x[p] - _x[q], dy = _y[p] - _y[q],
+                          dz = _z[p] - _z[q];
+              if (std::abs(dz) <= max_slope * std::sqrt(dx * dx + dy * dy)) {
+                _ground[p] = _ground[q] = 1;
+              }
+            }
+            lower = long(p);
+          }
+        },
+        64);
+  }
+
+  Params _params;
+  std::vector<float> _range, _x, _y, _z;
+  std::vector<int> _index;
+  std::vector<uint8_t> _ground;
+};
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "kd_tree.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "sophus/se3.hpp"
+#include "voxel_map.h"
+
+/**
+ * Scan registration by point-to-plane ICP or GICP.
+ *
+ * The target is either a scan, indexed once (KdTree) with its normals
+ * (point-to-plane) or plane-like covariances (GICP) estimated in parallel
+ * from kNN batches, or a VoxelMap, whose voxels carry their planes, so that
+ * scan-to-map registration builds no target index per scan.
+ * Each Gauss-Newton iteration
+ * 1. transforms the source and finds the closest target points (kNN batch
+ *    or VoxelMap::nearest_batch)
+ * 2. builds the 6x6 normal equations per thread block and sums the blocks
+ * 3. solves for a twist (translation, rotation) and updates the pose on the
+ *    left with Sophus::SE3d::exp
+ * Residuals are Huber-weighted. The time of every stage is kept in Stats
+ * and in the profiler zones.
+ */
+class Registration {
+ public:
+  enum class Method { PointToPlane, GICP };
+
+  struct Params {
+    Method method = Method::GICP;
+    int max_iterations = 30;
+    // correspondences farther apart are ignored (m)
+    float max_correspondence_distance = 1.0f;
+    // neighbours of the normal / covariance estimation
+    int covariance_neighbours = 10;
+    // Huber threshold of the residuals (m, Mahalanobis for GICP)
+    double huber = 0.5;
+    // convergence: update below these (m, rad)
+    double translation_epsilon = 1e-4;
+    double rotation_epsilon = 1e-4;
+  };
+
+  struct Stats {
+    int iterations = 0;
+    size_t correspondences = 0;
+    // mean squared residual of the last iteration
+    double error = 0;
+    double covariance_ms = 0, correspondence_ms = 0, reduction_ms = 0,
+           solve_ms = 0, total_ms = 0;
+
+    void print(std::ostream &out = std::cout) const {
+      out << "ICP: " << iterations << " iterations, " << correspondences
+          << " correspondences, error " << error << ", " << total_ms
+          << " ms (covariance " << covariance_ms << ", correspondence "
+          << correspondence_ms << ", reduction " << reduction_ms
+          << ", solve " << solve_ms << ")" << std::endl;
+    }
+  };
+
+  Registration() : Registration(Params()) {}
+  explicit Registration(const Params &params) : _params(params) {}
+
+  const Params &params() const { return _params; }
+  const Stats &stats() const { return _stats; }
+
+  /** index the target and estimate its normals / covariances */
+  void set_target(const std::vector<Eigen::Vector3f> &target) {
+    const auto begin = Clock::now();
+    _map = nullptr;
+    _target = target;
+    _target_tree.build(_target.data(), _target.size());
+    estimate_covariances(_target, _target_tree, _target_covariances,
+                         _target_normals);
+    _target_ms = elapsed_ms(begin);
+  }
+
+  /**
+   * align to the map (normals / covariances of its voxels) from now on
+   * @param map must outlive the alignments and not change during one
+   */
+  void set_target(const VoxelMap &map) {
+    _map = &map;
+    _target.clear();
+    _target_ms = 0;
+  }
+
+  /**
+   * pose of the source in the target frame
+   * @param guess initial pose
+   */
+  Sophus::SE3d align(const std::vector<Eigen::Vector3f> &source,
+                     const Sophus::SE3d &guess) {
+    UTILS_PROFILE_SCOPE("icp");
+    const auto begin = Clock::now();
+    _stats = Stats();
+    _stats.covariance_ms = _target_ms;
+    if (_params.method == Method::GICP) {
+      const auto covariance_begin = Clock::now();
+      _source_tree.build(source.data(), source.size());
+      estimate_covariances(source, _source_tree, _source_covariances,
+                           _source_normals);
+      _stats.covariance_ms += elapsed_ms(covariance_begin);
+    }
+
+    Sophus::SE3d pose = guess;
+    const size_t n = source.size();
+    _transformed.resize(n);
+    _matches.resize(n);
+    _sq_distances.resize(n);
+    if (_map) {
+      _map_points.resize(n);
+      _map_voxels.resize(n);
+    }
+    const float max_sq = _params.max_correspondence_distance *
+                         _params.max_correspondence_distance;
+
+    for (int iteration = 0; iteration < _params.max_iterations; iteration++) {
+      _stats.iterations = iteration + 1;
+      {
+        UTILS_PROFILE_SCOPE("icp-correspondence");
+        const auto stage = Clock::now();
+        const Eigen::Matrix3f R = pose.rotationMatrix().cast<float>();
+        const Eigen::Vector3f t = pose.translation().cast<float>();
+        parallel_for(
+            0, n, [&](size_t i) { _transformed[i] = R * source[i] + t; },
+            4096);
+        if (_map) {
+          _map->nearest_batch(_transformed.data(), n, _map_points.data(),
+                              _sq_distances.data(), _map_voxels.data());
+          for (size_t i = 0; i < n; i++) {
+            _matches[i] = _sq_distances[i] < max_sq ? int(i) : -1;
+          }
+        } else {
+          _target_tree.knn_batch(_transformed.data(), n, 1, _matches.data(),
+                                 _sq_distances.data(), nullptr, max_sq);
+        }
+        _stats.correspondence_ms += elapsed_ms(stage);
+      }
+
+      Eigen::Matrix<double, 6, 6> H;
+      Eigen::Matrix<double, 6, 1> b;
+      {
+        UTILS_PROFILE_SCOPE("icp-reduction");
+        const auto stage = Clock::now();
+        reduce(pose, H, b);
+        _stats.reduction_ms += elapsed_ms(stage);
+      }
+      if (_stats.correspondences < 6) break;
+
+      const auto stage = Clock::now();
+      // twist (translation, rotation) applied on the left
+      const Eigen::Matrix<double, 6, 1> delta = H.ldlt().solve(-b);
+      pose = Sophus::SE3d::exp(delta) * pose;
+      _stats.solve_ms += elapsed_ms(stage);
+      if (delta.head<3>().norm() < _params.translation_epsilon &&
+          delta.tail<3>().norm() < _params.rotation_epsilon) {
+        break;
+      }
+    }
+    _stats.total_ms = elapsed_ms(begin) + _target_ms;
+    return pose;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  using Matrix6d = Eigen::Matrix<double, 6, 6>;
+  using Vector6d = Eigen::Matrix<double, 6, 1>;
+
+  static double elapsed_ms(Clock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin)
+        .count();
+  }
+
+  /** partial normal equations of one thread block */
+  struct Block {
+    Matrix6d H;
+    Vector6d b;
+    double error;
+    size_t count;
+  };
+
+  /**
+   * per point: normal of the local plane and, for GICP, the covariance
+   * with the plane's eigenvalues replaced by (1, 1, 1e-3)
+   */
+  void estimate_covariances(const std::vector<Eigen::Vector3f> &points,
+                            const KdTree &tree,
+                            std::vector<Eigen::Matrix3d> &covariances,
+                            std::vector<Eigen::Vector3d> &normals) {
+    UTILS_PROFILE_SCOPE("icp-covariance");
+    const size_t n = points.size();
+    const int k = _params.covariance_neighbours;
+    _knn_indices.resize(n * size_t(k));
+    _knn_distances.resize(n * size_t(k));
+    tree.knn_batch(points.data(), n, k, _knn_indices.data(),
+                   _knn_distances.data());
+    covariances.resize(n);
+    normals.resize(n);
+    const Eigen::Vector3d plane(1, 1, 1e-3);
+
+    parallel_for(
+        0, n,
+        [&](size_t i) {
+          const int *neighbours = &_knn_indices[i * size_t(k)];
+          Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+          Eigen::Matrix3d second = Eigen::Matrix3d::Zero();
+          int count = 0;
+          for (int j = 0; j < k && neighbours[j] >= 0; j++, count++) {
+            const Eigen::Vector3d p =
+                points[size_t(neighbours[j])].cast<double>();
+            mean += p;
+            second += p * p.transpose();
+          }
+          if (count < 3) {
+            covariances[i] = Eigen::Matrix3d::Identity();
+            normals[i] = Eigen::Vector3d::Zero();
+            return;
+          }
+          mean /= count;
+          const Eigen::Matrix3d covariance =
+              second / count - mean * mean.transpose();
+          // ascending eigenvalues: the first eigenvector is the normal
+          const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(
+              covariance);
+          const Eigen::Matrix3d &U = solver.eigenvectors();
+          normals[i] = U.col(0);
+          covariances[i] = U * plane.reverse().asDiagonal() * U.transpose();
+        },
+        1024);
+  }
+
+  /** normal equations summed over fixed blocks (deterministic order) */
+  void reduce(const Sophus::SE3d &pose, Matrix6d &H, Vector6d &b) {
+    const size_t n = _transformed.size();
+    const size_t num_blocks = std::max<size_t>(
+        1, std::min<size_t>(ThreadPool::instance().size() * 4, n / 1024));
+    _blocks.resize(num_blocks);
+    const Eigen::Matrix3d R = pose.rotationMatrix();
+
+    parallel_for(0, num_blocks, [&](size_t block) {
+      Block &out = _blocks[block];
+      out.H.setZero();
+      out.b.setZero();
+      out.error = 0;
+      out.count = 0;
+      for (size_t i = block * n / num_blocks;
+           i < (block + 1) * n / num_blocks; i++) {
+        if (_matches[i] < 0) continue;
+        // map matches are indexed like the source
+        const size_t target = size_t(_matches[i]);
+        const Eigen::Vector3d p = _transformed[i].cast<double>();
+        const Eigen::Vector3d e =
+            p - (_map ? _map_points[target] : _target[target]).cast<double>();
+        // d(exp(xi) T p) / d(xi) = [I, -[p]x]
+        Eigen::Matrix<double, 3, 6> J;
+        J.leftCols<3>().setIdentity();
+        J.rightCols<3>() << 0, p.z(), -p.y(), -p.z(), 0, p.x(), p.y(), -p.x(),
+            0;
+
+        if (_params.method == Method::PointToPlane) {
+          const Eigen::Vector3d &normal =
+              _map ? _map_voxels[target]->normal : _target_normals[target];
+          const double r = normal.dot(e);
+          const double w = huber_weight(std::abs(r));
+          const Eigen::Matrix<double, 1, 6> Jr = normal.transpose() * J;
+          out.H += w * Jr.transpose() * Jr;
+          out.b += w * Jr.transpose() * r;
+          out.error += r * r;
+        } else {
+          const Eigen::Matrix3d C =
+              (_map ? _map_voxels[target]->covariance
+                    : _target_covariances[target]) +
+              R * _source_covariances[i] * R.transpose();
+          const Eigen::Matrix3d M = C.inverse();
+          const double r2 = e.dot(M * e);
+          const double w = huber_weight(std::sqrt(r2));
+          out.H += w * J.transpose() * M * J;
+          out.b += w * J.transpose() * M * e;
+          out.error += r2;
+        }
+        out.count++;
+      }
+    });
+
+    H.setZero();
+    b.setZero();
+    double error = 0;
+    size_t count = 0;
+    for (const Block &block : _blocks) {
+      H += block.H;
+      b += block.b;
+      error += block.error;
+      count += block.count;
+    }
+    _stats.correspondences = count;
+    _stats.error = count > 0 ? error / double(count) : 0;
+  }
+
+  double huber_weight(double residual) const {
+    return residual <= _params.huber ? 1.0 : _params.huber / residual;
+  }
+
+  Params _params;
+  Stats _stats;
+  double _target_ms = 0;
+
+  std::vector<Eigen::Vector3f> _target;
+  const VoxelMap *_map = nullptr;
+  KdTree _target_tree, _source_tree;
+  std::vector<Eigen::Matrix3d> _target_covariances, _source_covariances;
+  std::vector<Eigen::Vector3d> _target_normals, _source_normals;
+
+  // buffers reused between scans
+  std::vector<Eigen::Vector3f> _transformed;
+  std::vector<int> _matches, _knn_indices;
+  std::vector<float> _sq_distances, _knn_distances;
+  std::vector<Block> _blocks;
+  // closest map point and its voxel per source point
+  std::vector<Eigen::Vector3f> _map_points;
+  std::vector<const VoxelMap::Voxel *> _map_voxels;
+};
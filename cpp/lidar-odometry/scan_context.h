@@ -0,0 +1,313 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "profiler.h"
+
+/**
+ * Place recognition by Scan Context (G. Kim and A. Kim, IROS 2018).
+ *
+ * A scan is described by the maximum height of its points in rings x
+ * sectors polar bins around the sensor, quantised to bytes. Candidates of
+ * a query are the nearest ring keys (the mean of each ring, invariant to
+ * yaw) in a KD-tree over the database, plus the scans added after the
+ * tree was last rebuilt; the candidates are then compared column by column
+ * at every sector shift at once: the cosines of all column pairs are one
+ * sectors x sectors matrix product (vectorised by Eigen), and each shift
+ * sums one wrapped diagonal of it.
+ */
+class ScanContext {
+ public:
+  struct Params {
+    int rings = 20;
+    int sectors = 60;
+    // points farther than this are ignored (m)
+    float max_radius = 80;
+    // added to the heights so that the ground is positive (m)
+    float lidar_height = 2;
+    // height of one step of the byte cells (m)
+    float height_resolution = 0.05f;
+    // ring-key neighbours compared in full
+    int candidates = 10;
+    // the latest scans are not loop candidates
+    int exclude_recent = 50;
+    // loops are accepted below this distance (1 - mean column cosine)
+    float threshold = 0.2f;
+    // the ring-key tree is rebuilt after this many new candidates
+    int rebuild_interval = 50;
+  };
+
+  struct Descriptor {
+    // sector-major: the rings of sector s are cells[s * rings ...]
+    std::vector<uint8_t> cells;
+    Eigen::VectorXf ring_key;
+  };
+
+  struct Match {
+    // database index, -1 if there is no loop
+    int index = -1;
+    float distance = 1;
+    // yaw of the query in the frame of the match (rad)
+    float yaw = 0;
+  };
+
+  ScanContext() : ScanContext(Params()) {}
+  explicit ScanContext(const Params &params) : _params(params) {}
+
+  const Params &params() const { return _params; }
+  size_t size() const { return _num_scans; }
+
+  void describe(const std::vector<Eigen::Vector3f> &points,
+                Descriptor &descriptor) const {
+    UTILS_PROFILE_SCOPE("scan-context");
+    const int rings = _params.rings, sectors = _params.sectors;
+    descriptor.cells.assign(size_t(rings * sectors), 0);
+    const float ring_step = _params.max_radius / float(rings);
+    const float sector_step = float(2 * M_PI) / float(sectors);
+    for (const auto &p : points) {
+      const float r = std::sqrt(p.x() * p.x() + p.y() * p.y());
+      if (r >= _params.max_radius) continue;
+      const int ring = std::min(int(r / ring_step), rings - 1);
+      const int sector = std::min(
+          int((std::atan2(p.y(), p.x()) + float(M_PI)) / sector_step),
+          sectors - 1);
+      const float steps =
+          (p.z() + _params.lidar_height) / _params.height_resolution;
+      const uint8_t height = uint8_t(std::clamp(steps + 0.5f, 0.f, 255.f));
+      uint8_t &cell = descriptor.cells[size_t(sector * rings + ring)];
+      cell = std::max(cell, height);
+    }
+
+    descriptor.ring_key = Eigen::VectorXf::Zero(rings);
+    for (int s = 0; s < sectors; s++) {
+      for (int ring = 0; ring < rings; ring++) {
+        descriptor.ring_key[ring] += descriptor.cells[size_t(s * rings + ring)];
+      }
+    }
+    descriptor.ring_key *= _params.height_resolution / float(sectors);
+  }
+
+  /** stores the scan as index size() */
+  void add(const Descriptor &descriptor) {
+    _cells.insert(_cells.end(), descriptor.cells.begin(),
+                  descriptor.cells.end());
+    _ring_keys.insert(_ring_keys.end(), descriptor.ring_key.data(),
+                      descriptor.ring_key.data() + _params.rings);
+    _num_scans++;
+    const size_t eligible = num_eligible();
+    if (eligible >= _tree.size() + size_t(_params.rebuild_interval)) {
+      UTILS_PROFILE_SCOPE("scan-context-tree");
+      _tree.build(_ring_keys.data(), eligible, _params.rings);
+    }
+  }
+
+  /**
+   * closest earlier place (except the exclude_recent latest scans)
+   * @return index -1 unless the distance is below the threshold
+   */
+  Match query(const Descriptor &descriptor) const {
+    UTILS_PROFILE_SCOPE("scan-context-query");
+    const size_t k = size_t(_params.candidates);
+    const int rings = _params.rings;
+    std::vector<std::pair<float, int>> candidates;
+    _tree.knn(descriptor.ring_key.data(), k, candidates);
+    for (size_t i = _tree.size(); i < num_eligible(); i++) {
+      const Eigen::Map<const Eigen::VectorXf> key(
+          &_ring_keys[i * size_t(rings)], rings);
+      insert(candidates, k, (key - descriptor.ring_key).squaredNorm(),
+             int(i));
+    }
+
+    Match best;
+    const Eigen::MatrixXf query = columns(descriptor.cells.data());
+    for (const auto &candidate : candidates) {
+      int shift;
+      const float d = distance(
+          query, columns(cell_data(size_t(candidate.second))), shift);
+      if (d < best.distance) {
+        best.index = candidate.second;
+        best.distance = d;
+        best.yaw = float(2 * M_PI) * float(shift) / float(_params.sectors);
+      }
+    }
+    if (best.distance >= _params.threshold) best.index = -1;
+    return best;
+  }
+
+  /**
+   * 1 - mean cosine of the non-empty column pairs at the best shift
+   * @param shift sector s of a matches sector s + shift of b
+   */
+  float distance(const Descriptor &a, const Descriptor &b, int &shift) const {
+    return distance(columns(a.cells.data()), columns(b.cells.data()), shift);
+  }
+
+ private:
+  /** bounded sorted list of (squared distance, index) */
+  static void insert(std::vector<std::pair<float, int>> &best, size_t k,
+                     float sq_distance, int index) {
+    if (best.size() == k && sq_distance >= best.back().first) return;
+    const std::pair<float, int> entry(sq_distance, index);
+    best.insert(std::upper_bound(best.begin(), best.end(), entry), entry);
+    if (best.size() > k) best.pop_back();
+  }
+
+  /** KD-tree over ring keys (any dimension) */
+  class KeyTree {
+   public:
+    size_t size() const { return _ids.size(); }
+
+    void build(const float *keys, size_t count, int dim) {
+      _dim = dim;
+      _ids.resize(count);
+      std::iota(_ids.begin(), _ids.end(), 0);
+      _nodes.clear();
+      if (count > 0) build_node(keys, 0, count);
+      // keys in leaf order
+      _keys.resize(count * size_t(dim));
+      for (size_t i = 0; i < count; i++) {
+        std::copy_n(keys + size_t(_ids[i]) * size_t(dim), dim,
+                    &_keys[i * size_t(dim)]);
+      }
+    }
+
+    /** merges the k nearest keys into best */
+    void knn(const float *query, size_t k,
+             std::vector<std::pair<float, int>> &best) const {
+      if (!_nodes.empty()) search(0, query, k, best);
+    }
+
+   private:
+    static constexpr size_t kLeafSize = 16;
+
+    struct Node {
+      float split;
+      // split dimension, -1 for leaves
+      int axis;
+      // inner nodes: right child; leaves: first key
+      uint32_t first;
+      uint32_t count;
+    };
+
+    size_t build_node(const float *keys, size_t begin, size_t end) {
+      const size_t index = _nodes.size();
+      _nodes.push_back({0, -1, uint32_t(begin), uint32_t(end - begin)});
+      if (end - begin <= kLeafSize) return index;
+
+      // widest dimension
+      int axis = 0;
+      float widest = -1;
+      for (int d = 0; d < _dim; d++) {
+        float lo = std::numeric_limits<float>::max(), hi = -lo;
+        for (size_t i = begin; i < end; i++) {
+          const float v = keys[size_t(_ids[i]) * size_t(_dim) + size_t(d)];
+          lo = std::min(lo, v);
+          hi = std::max(hi, v);
+        }
+        if (hi - lo > widest) {
+          widest = hi - lo;
+          axis = d;
+        }
+      }
+      const size_t half = (begin + end) / 2;
+      auto value = [&](int id) {
+        return keys[size_t(id) * size_t(_dim) + size_t(axis)];
+      };
+      std::nth_element(
+          _ids.begin() + long(begin), _ids.begin() + long(half),
+          _ids.begin() + long(end),
+          [&](int a, int b) { return value(a) < value(b); });
+      const float split = value(_ids[half]);
+      build_node(keys, begin, half);
+      const size_t right = build_node(keys, half, end);
+      _nodes[index] = {split, axis, uint32_t(right), 0};
+      return index;
+    }
+
+    void search(size_t index, const float *query, size_t k,
+                std::vector<std::pair<float, int>> &best) const {
+      const Node &node = _nodes[index];
+      if (node.axis < 0) {
+        const Eigen::Map<const Eigen::VectorXf> q(query, _dim);
+        for (size_t i = node.first; i < node.first + node.count; i++) {
+          const Eigen::Map<const Eigen::VectorXf> key(&_keys[i * size_t(_dim)],
+                                                      _dim);
+          insert(best, k, (key - q).squaredNorm(), _ids[i]);
+        }
+        return;
+      }
+      const float diff = query[node.axis] - node.split;
+      const size_t near = diff < 0 ? index + 1 : node.first;
+      const size_t far = diff < 0 ? node.first : index + 1;
+      search(near, query, k, best);
+      if (best.size() < k || diff * diff < best.back().first) {
+        search(far, query, k, best);
+      }
+    }
+
+    int _dim = 0;
+    std::vector<Node> _nodes;
+    std::vector<int> _ids;
+    std::vector<float> _keys;
+  };
+
+  size_t num_eligible() const {
+    const size_t recent = size_t(_params.exclude_recent);
+    return _num_scans > recent ? _num_scans - recent : 0;
+  }
+
+  const uint8_t *cell_data(size_t index) const {
+    return &_cells[index * size_t(_params.rings * _params.sectors)];
+  }
+
+  /** rings x sectors heights in metres */
+  Eigen::MatrixXf columns(const uint8_t *cells) const {
+    return Eigen::Map<const Eigen::Matrix<uint8_t, Eigen::Dynamic,
+                                          Eigen::Dynamic>>(
+               cells, _params.rings, _params.sectors)
+               .cast<float>();
+  }
+
+  float distance(const Eigen::MatrixXf &a, const Eigen::MatrixXf &b,
+                 int &shift) const {
+    const int sectors = _params.sectors;
+    const Eigen::RowVectorXf norm_a = a.colwise().norm();
+    const Eigen::RowVectorXf norm_b = b.colwise().norm();
+    // dot products of every column pair
+    const Eigen::MatrixXf dots = a.transpose() * b;
+
+    float best = 1;
+    shift = 0;
+    for (int s = 0; s < sectors; s++) {
+      float sum = 0;
+      int count = 0;
+      for (int c = 0; c < sectors; c++) {
+        const int d = (c + s) % sectors;
+        const float norms = norm_a[c] * norm_b[d];
+        if (norms <= 0) continue;
+        sum += dots(c, d) / norms;
+        count++;
+      }
+      const float distance = count > 0 ? 1 - sum / float(count) : 1;
+      if (distance < best) {
+        best = distance;
+        shift = s;
+      }
+    }
+    return best;
+  }
+
+  Params _params;
+  size_t _num_scans = 0;
+  // descriptors and ring keys of the database, contiguous
+  std::vector<uint8_t> _cells;
+  std::vector<float> _ring_keys;
+  KeyTree _tree;
+};
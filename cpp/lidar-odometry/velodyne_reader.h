@@ -0,0 +1,231 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Eigen/Core>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** one point of a velodyne .bin file */
+struct VelodynePoint {
+  float x, y, z, intensity;
+};
+static_assert(sizeof(VelodynePoint) == 4 * sizeof(float),
+              "VelodynePoint must match the file layout");
+
+/** read-only private mapping of a whole file */
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { close(); }
+
+  /**
+   * map the file and start reading it in the background (MADV_WILLNEED)
+   * @return false if the file does not exist
+   */
+  bool open(const std::string &path) {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      if (errno == ENOENT) return false;
+      throw std::runtime_error("Unable to open " + path + ": " +
+                               std::strerror(errno));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Unable to stat " + path);
+    }
+    _size = size_t(st.st_size);
+    if (_size > 0) {
+      void *data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        ::close(fd);
+        _size = 0;
+        throw std::runtime_error("Unable to map " + path);
+      }
+      _data = data;
+      ::madvise(_data, _size, MADV_WILLNEED);
+    }
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+    return true;
+  }
+
+  void close() {
+    if (_data) ::munmap(_data, _size);
+    _data = nullptr;
+    _size = 0;
+  }
+
+  /** the whole file is read in order from now on */
+  void advise_sequential() const {
+    if (_data) ::madvise(_data, _size, MADV_SEQUENTIAL);
+  }
+
+  const void *data() const { return _data; }
+  size_t size() const { return _size; }
+
+ private:
+  void *_data = nullptr;
+  size_t _size = 0;
+};
+
+/**
+ * Points of a mapped scan, without copies.
+ *
+ * The file stores x, y, z, intensity per point; each attribute is exposed
+ * as a column (stride of 4 floats), the whole scan as a 4xN Eigen map and
+ * as raw xyzi floats (LaserScan::assign). Valid until the reader moves on.
+ */
+class VelodyneScan {
+ public:
+  /** one attribute of every point */
+  class Column {
+   public:
+    Column(const float *base, size_t size) : _base(base), _size(size) {}
+    float operator[](size_t i) const { return _base[4 * i]; }
+    size_t size() const { return _size; }
+    /** zero-copy Eigen view (inner stride 4) */
+    Eigen::Map<const Eigen::VectorXf, 0, Eigen::InnerStride<4>> map() const {
+      return {_base, Eigen::Index(_size)};
+    }
+
+   private:
+    const float *_base;
+    size_t _size;
+  };
+
+  VelodyneScan() = default;
+  VelodyneScan(int frame_id, const VelodynePoint *points, size_t size)
+      : _frame_id(frame_id), _points(points), _size(size) {}
+
+  int frame_id() const { return _frame_id; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  const VelodynePoint &operator[](size_t i) const { return _points[i]; }
+  const VelodynePoint *begin() const { return _points; }
+  const VelodynePoint *end() const { return _points + _size; }
+  const float *xyzi() const { return &_points->x; }
+
+  Column x() const { return {&_points->x, _size}; }
+  Column y() const { return {&_points->y, _size}; }
+  Column z() const { return {&_points->z, _size}; }
+  Column intensity() const { return {&_points->intensity, _size}; }
+
+  /** rows x, y, z, intensity; one column per point */
+  Eigen::Map<const Eigen::Matrix<float, 4, Eigen::Dynamic>> matrix() const {
+    return {xyzi(), 4, Eigen::Index(_size)};
+  }
+
+  /**
+   * fill a pcl::PointCloud (or any cloud with x, y, z, intensity fields);
+   * PCL clouds own their points, so this copies, but the cloud's storage is
+   * reused between scans
+   */
+  template <class Cloud>
+  void to_cloud(Cloud &cloud) const {
+    cloud.resize(_size);
+    for (size_t i = 0; i < _size; i++) {
+      auto &point = cloud[i];
+      point.x = _points[i].x;
+      point.y = _points[i].y;
+      point.z = _points[i].z;
+      point.intensity = _points[i].intensity;
+    }
+    cloud.width = uint32_t(_size);
+    cloud.height = 1;
+    cloud.is_dense = true;
+  }
+
+ private:
+  int _frame_id = -1;
+  const VelodynePoint *_points = nullptr;
+  size_t _size = 0;
+};
+
+/**
+ * Streams the velodyne/%06d.bin scans of a sequence through memory maps.
+ *
+ * The next `prefetch` scans are mapped ahead with MADV_WILLNEED so the
+ * kernel reads them while the current one is processed; mappings are
+ * recycled in a ring, so there is no parsing and no allocation per scan.
+ */
+class VelodyneReader {
+ public:
+  /**
+   * @param sequence_path KITTI sequence directory (with velodyne/)
+   * @param first first frame
+   * @param last frame after the last one
+   */
+  VelodyneReader(std::string sequence_path, int first, int last,
+                 size_t prefetch = 4)
+      : _sequence_path(std::move(sequence_path)),
+        _next(first),
+        _last(last),
+        // the scan handed out, the prefetched ones and the one to hand out
+        _files(prefetch + 2) {
+    for (size_t i = 0; i < prefetch; i++) map_ahead();
+  }
+
+  std::string scan_path(int frame_id) const {
+    return (boost::format("%s/velodyne/%06d.bin") % _sequence_path % frame_id)
+        .str();
+  }
+
+  /**
+   * move to the next scan (the previous one is unmapped once its slot is
+   * reused)
+   * @return false at the end of the sequence
+   */
+  bool next(VelodyneScan &scan) {
+    map_ahead();
+    if (_queued == 0) return false;
+    Slot &slot = _files[_head];
+    _head = (_head + 1) % _files.size();
+    _queued--;
+
+    slot.file.advise_sequential();
+    scan = VelodyneScan(slot.frame_id,
+                        static_cast<const VelodynePoint *>(slot.file.data()),
+                        slot.file.size() / sizeof(VelodynePoint));
+    return true;
+  }
+
+ private:
+  struct Slot {
+    int frame_id = -1;
+    MappedFile file;
+  };
+
+  /** map the next frame into the free slot, if any */
+  void map_ahead() {
+    // one slot stays with the scan handed out last
+    if (_ended || _queued + 1 >= _files.size() || _next >= _last) return;
+    Slot &slot = _files[(_head + _queued) % _files.size()];
+    if (!slot.file.open(scan_path(_next))) {
+      _ended = true;
+      return;
+    }
+    slot.frame_id = _next++;
+    _queued++;
+  }
+
+  const std::string _sequence_path;
+  int _next, _last;
+  bool _ended = false;
+  std::vector<Slot> _files;
+  // oldest queued slot and number of queued slots
+  size_t _head = 0, _queued = 0;
+};
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "parallel.h"
+#include "point_cloud.h"
+#include "profiler.h"
+
+/**
+ * Voxel-grid downsampling: one output point per occupied voxel.
+ *
+ * Points are binned by a hash of their voxel key in linear time on the
+ * thread pool:
+ * 1. keys and hash buckets per point, counted per block of points
+ * 2. a stable counting sort of the point indices by bucket
+ * 3. one task per bucket inserts its points into its own open-addressing
+ *    table and reduces each voxel (centroid, first point, or point closest
+ *    to the voxel centre)
+ * 4. the voxels are written bucket by bucket into the caller's output
+ * No step depends on the thread schedule, so the output (order included)
+ * is deterministic. All scratch buffers are members that only grow, and
+ * the output is resized in place, so a loop over scans of similar size
+ * does not allocate.
+ */
+class VoxelGrid {
+ public:
+  enum class Mode { Centroid, First, ClosestToCentre };
+
+  struct Params {
+    float voxel_size = 1.0f;
+    Mode mode = Mode::Centroid;
+  };
+
+  VoxelGrid() : VoxelGrid(Params()) {}
+  explicit VoxelGrid(const Params &params)
+      : _params(params), _inv_voxel_size(1 / params.voxel_size) {}
+
+  const Params &params() const { return _params; }
+
+  /** @param out resized to the number of voxels */
+  void filter(const std::vector<Eigen::Vector3f> &points,
+              std::vector<Eigen::Vector3f> &out) {
+    UTILS_PROFILE_SCOPE("voxel-grid");
+    run(
+        points.size(),
+        [&](size_t i) {
+          const Eigen::Vector3f &p = points[i];
+          return Eigen::Vector4f(p.x(), p.y(), p.z(), 0);
+        },
+        [&](size_t num_voxels) { out.resize(num_voxels); },
+        [&](size_t v, const Eigen::Vector4f &p) { out[v] = p.head<3>(); });
+  }
+
+  /**
+   * intensities are averaged (centroid) or taken from the selected point
+   * @param out resized to the number of voxels; must not be cloud
+   */
+  void filter(const PointCloud &cloud, PointCloud &out) {
+    UTILS_PROFILE_SCOPE("voxel-grid");
+    run(
+        cloud.size(),
+        [&](size_t i) {
+          return Eigen::Vector4f(cloud.x()[i], cloud.y()[i], cloud.z()[i],
+                                 cloud.intensity()[i]);
+        },
+        [&](size_t num_voxels) { out.resize(num_voxels); },
+        [&](size_t v, const Eigen::Vector4f &p) {
+          for (int a = 0; a < PointCloud::kAttributes; a++) {
+            out.data(PointCloud::Attribute(a))[v] = p[a];
+          }
+        });
+  }
+
+ private:
+  // buckets of the counting sort (tasks of step 3)
+  static constexpr uint32_t kBuckets = 256;
+  // bucket of non-finite points (dropped)
+  static constexpr uint32_t kInvalid = kBuckets;
+  static constexpr uint64_t kEmpty = ~uint64_t(0);
+  static constexpr size_t kBlockSize = 4096;
+
+  struct Slot {
+    uint64_t key;
+    uint32_t voxel;
+  };
+
+  struct Voxel {
+    void reset(uint32_t first) {
+      sum.setZero();
+      count = 0;
+      selected = first;
+      best = std::numeric_limits<float>::max();
+    }
+
+    Eigen::Vector4d sum;
+    double count;
+    uint32_t selected;
+    // squared distance of the selected point to the voxel centre
+    float best;
+  };
+
+  /** 21 bits per axis (+-2^20 voxels) */
+  static uint64_t pack(const Eigen::Vector3i &key) {
+    const uint64_t mask = (uint64_t(1) << 21) - 1;
+    return (uint64_t(uint32_t(key.x())) & mask) << 42 |
+           (uint64_t(uint32_t(key.y())) & mask) << 21 |
+           (uint64_t(uint32_t(key.z())) & mask);
+  }
+  /**
+   * 64-bit finaliser of MurmurHash3: the top bits pick the bucket and the
+   * low bits the slot, so every bit of the key has to reach both
+   */
+  static uint64_t hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDull;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ull;
+    return key ^ (key >> 33);
+  }
+
+  Eigen::Vector3i cell(const Eigen::Vector3f &p) const {
+    return (p * _inv_voxel_size).array().floor().cast<int>();
+  }
+
+  /**
+   * @param point (x, y, z, intensity) of the i-th input point
+   * @param resize called with the number of voxels before write
+   * @param write called with (output index, point) of every voxel
+   */
+  template <class Point, class Resize, class Write>
+  void run(size_t count, Point &&point, Resize &&resize, Write &&write) {
+    const size_t num_blocks = (count + kBlockSize - 1) / kBlockSize;
+    const size_t row = kBuckets + 1;
+    _keys.resize(count);
+    _buckets.resize(count);
+    _order.resize(count);
+    _histogram.assign(num_blocks * row, 0);
+
+    // 1. keys and bucket counts per block
+    parallel_for(0, num_blocks, [&](size_t block) {
+      uint32_t *histogram = &_histogram[block * row];
+      const size_t end = std::min(count, (block + 1) * kBlockSize);
+      for (size_t i = block * kBlockSize; i < end; i++) {
+        const Eigen::Vector3f p = point(i).template head<3>();
+        if (p.allFinite()) {
+          _keys[i] = pack(cell(p));
+          _buckets[i] = uint32_t(hash(_keys[i]) >> 56);
+        } else {
+          _buckets[i] = kInvalid;
+        }
+        histogram[_buckets[i]]++;
+      }
+    });
+
+    // 2. stable counting sort by bucket (the invalid points go last); the
+    //    table of a bucket is a power of two of at least twice its points
+    _bucket_offsets.resize(row + 1);
+    _table_offsets.resize(row);
+    size_t position = 0;
+    for (uint32_t b = 0; b < row; b++) {
+      _bucket_offsets[b] = position;
+      for (size_t block = 0; block < num_blocks; block++) {
+        uint32_t &entry = _histogram[block * row + b];
+        const uint32_t n = entry;
+        entry = uint32_t(position);
+        position += n;
+      }
+    }
+    _bucket_offsets[row] = position;
+    _table_offsets[0] = 0;
+    for (uint32_t b = 0; b < kBuckets; b++) {
+      const size_t n = _bucket_offsets[b + 1] - _bucket_offsets[b];
+      size_t size = n > 0 ? 2 : 0;
+      while (size < 2 * n) size *= 2;
+      _table_offsets[b + 1] = _table_offsets[b] + size;
+    }
+    parallel_for(0, num_blocks, [&](size_t block) {
+      uint32_t *cursor = &_histogram[block * row];
+      const size_t end = std::min(count, (block + 1) * kBlockSize);
+      for (size_t i = block * kBlockSize; i < end; i++) {
+        _order[cursor[_buckets[i]]++] = uint32_t(i);
+      }
+    });
+
+    // 3. hashing and reduction per bucket; the voxels of a bucket are
+    //    stored from its first sorted point on (there are no more of them)
+    _slots.resize(_table_offsets[kBuckets]);
+    _voxels.resize(_bucket_offsets[kBuckets]);
+    _num_bucket_voxels.resize(kBuckets);
+    parallel_for(
+        0, kBuckets,
+        [&](size_t b) {
+          Slot *table = _slots.data() + _table_offsets[b];
+          const size_t mask = _table_offsets[b + 1] - _table_offsets[b] - 1;
+          std::fill(table, table + (mask + 1), Slot{kEmpty, 0});
+          Voxel *voxels = _voxels.data() + _bucket_offsets[b];
+          uint32_t num_voxels = 0;
+          for (size_t j = _bucket_offsets[b]; j < _bucket_offsets[b + 1];
+               j++) {
+            const uint32_t i = _order[j];
+            const uint64_t key = _keys[i];
+            size_t s = size_t(hash(key)) & mask;
+            while (table[s].key != kEmpty && table[s].key != key) {
+              s = (s + 1) & mask;
+            }
+            if (table[s].key == kEmpty) {
+              table[s] = {key, num_voxels};
+              voxels[num_voxels++].reset(i);
+            }
+            accumulate(voxels[table[s].voxel], i, point(i));
+          }
+          _num_bucket_voxels[b] = num_voxels;
+        },
+        1);
+
+    // 4. output, bucket by bucket
+    _voxel_offsets.resize(kBuckets + 1);
+    _voxel_offsets[0] = 0;
+    for (uint32_t b = 0; b < kBuckets; b++) {
+      _voxel_offsets[b + 1] = _voxel_offsets[b] + _num_bucket_voxels[b];
+    }
+    resize(_voxel_offsets[kBuckets]);
+    parallel_for(
+        0, kBuckets,
+        [&](size_t b) {
+          const Voxel *voxels = _voxels.data() + _bucket_offsets[b];
+          for (uint32_t v = 0; v < _num_bucket_voxels[b]; v++) {
+            const Voxel &voxel = voxels[v];
+            write(_voxel_offsets[b] + v,
+                  _params.mode == Mode::Centroid
+                      ? Eigen::Vector4f((voxel.sum / voxel.count).cast<float>())
+                      : Eigen::Vector4f(point(voxel.selected)));
+          }
+        },
+        1);
+  }
+
+  void accumulate(Voxel &voxel, uint32_t i, const Eigen::Vector4f &p) const {
+    switch (_params.mode) {
+      case Mode::Centroid:
+        voxel.sum += p.cast<double>();
+        voxel.count++;
+        break;
+      case Mode::First:
+        // points arrive in index order: reset() has kept the first one
+        break;
+      case Mode::ClosestToCentre: {
+        const Eigen::Vector3f xyz = p.head<3>();
+        const Eigen::Vector3f centre =
+            (cell(xyz).cast<float>().array() + 0.5f) * _params.voxel_size;
+        const float sq = (xyz - centre).squaredNorm();
+        if (sq < voxel.best) {
+          voxel.best = sq;
+          voxel.selected = i;
+        }
+        break;
+      }
+    }
+  }
+
+  Params _params;
+  float _inv_voxel_size;
+
+  // buffers reused between calls
+  std::vector<uint64_t> _keys;
+  std::vector<uint32_t> _buckets, _order, _histogram, _num_bucket_voxels;
+  std::vector<size_t> _bucket_offsets, _table_offsets, _voxel_offsets;
+  std::vector<Slot> _slots;
+  std::vector<Voxel> _voxels;
+};
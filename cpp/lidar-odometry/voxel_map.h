@@ -0,0 +1,206 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "parallel.h"
+#include "profiler.h"
+
+/**
+ * Local map of registered scans in hashed voxels.
+ *
+ * Each voxel keeps at most max_points_per_voxel points, so inserting a scan
+ * is O(1) per point and the map density stays bounded; voxels farther than
+ * max_distance from the sensor are dropped after each update, which keeps
+ * the map (and the cost of a scan-to-map step) constant as the vehicle
+ * moves. Nearest-neighbour queries look at the 27 voxels around the query,
+ * so they are exact within voxel_size.
+ *
+ * Every voxel also keeps the plane of its points (normal, and the
+ * covariance with the plane's eigenvalues replaced by (1, 1, 1e-3) as in
+ * GICP), refreshed in parallel for the voxels a scan has changed, so that
+ * Registration can align to the map without a per-scan target index.
+ */
+class VoxelMap {
+ public:
+  struct Params {
+    float voxel_size = 1.0f;
+    size_t max_points_per_voxel = 20;
+    // voxels farther than this from the sensor are removed (m)
+    float max_distance = 100.0f;
+  };
+
+  using Key = Eigen::Vector3i;
+
+  struct Voxel {
+    std::vector<Eigen::Vector3f> points;
+    // zero (and identity covariance) below 3 points
+    Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d covariance = Eigen::Matrix3d::Identity();
+    // points added since the plane was estimated
+    bool changed = false;
+  };
+
+  VoxelMap() : VoxelMap(Params()) {}
+  explicit VoxelMap(const Params &params)
+      : _params(params), _inv_voxel_size(1 / params.voxel_size) {}
+
+  const Params &params() const { return _params; }
+  size_t num_voxels() const { return _voxels.size(); }
+  size_t num_points() const { return _num_points; }
+  bool empty() const { return _voxels.empty(); }
+
+  Key key(const Eigen::Vector3f &point) const {
+    return (point * _inv_voxel_size).array().floor().cast<int>();
+  }
+
+  /**
+   * add a scan in map coordinates and forget the voxels far from the sensor
+   * @param origin sensor position in map coordinates
+   */
+  void update(const std::vector<Eigen::Vector3f> &points,
+              const Eigen::Vector3f &origin) {
+    UTILS_PROFILE_SCOPE("map-update");
+    add(points);
+    remove_far(origin);
+  }
+
+  /** insert the points and re-estimate the planes of the changed voxels */
+  void add(const std::vector<Eigen::Vector3f> &points) {
+    _changed.clear();
+    for (const auto &point : points) {
+      Voxel &voxel = _voxels[key(point)];
+      if (voxel.points.size() >= _params.max_points_per_voxel) continue;
+      if (voxel.points.capacity() == 0) {
+        voxel.points.reserve(_params.max_points_per_voxel);
+      }
+      voxel.points.push_back(point);
+      _num_points++;
+      if (!voxel.changed) {
+        voxel.changed = true;
+        // element references survive rehashing
+        _changed.push_back(&voxel);
+      }
+    }
+    parallel_for(
+        0, _changed.size(), [&](size_t i) { estimate_plane(*_changed[i]); },
+        64);
+  }
+
+  void remove_far(const Eigen::Vector3f &origin) {
+    const float max_sq = _params.max_distance * _params.max_distance;
+    for (auto it = _voxels.begin(); it != _voxels.end();) {
+      const Eigen::Vector3f centre =
+          (it->first.cast<float>().array() + 0.5f) * _params.voxel_size;
+      if ((centre - origin).squaredNorm() > max_sq) {
+        _num_points -= it->second.points.size();
+        it = _voxels.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void clear() {
+    _voxels.clear();
+    _num_points = 0;
+  }
+
+  /**
+   * closest map point within the neighbouring voxels
+   * @return false if there is none
+   */
+  bool nearest(const Eigen::Vector3f &query, Eigen::Vector3f &point,
+               float &sq_distance, const Voxel **voxel = nullptr) const {
+    sq_distance = std::numeric_limits<float>::max();
+    const Key centre = key(query);
+    for (int dx = -1; dx <= 1; dx++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dz = -1; dz <= 1; dz++) {
+          const auto it = _voxels.find(centre + Key(dx, dy, dz));
+          if (it == _voxels.end()) continue;
+          for (const auto &candidate : it->second.points) {
+            const float d = (candidate - query).squaredNorm();
+            if (d < sq_distance) {
+              sq_distance = d;
+              point = candidate;
+              if (voxel) *voxel = &it->second;
+            }
+          }
+        }
+      }
+    }
+    return sq_distance < std::numeric_limits<float>::max();
+  }
+
+  /**
+   * nearest() of every query in parallel
+   * @param points n entries
+   * @param sq_distances n entries, max float where nothing was found
+   * @param voxels n entries, voxel of each point (may be null)
+   */
+  void nearest_batch(const Eigen::Vector3f *queries, size_t n,
+                     Eigen::Vector3f *points, float *sq_distances,
+                     const Voxel **voxels = nullptr) const {
+    parallel_for(
+        0, n,
+        [&](size_t i) {
+          nearest(queries[i], points[i], sq_distances[i],
+                  voxels ? &voxels[i] : nullptr);
+        },
+        256);
+  }
+
+  /** every point of the map */
+  void points(std::vector<Eigen::Vector3f> &out) const {
+    out.clear();
+    out.reserve(_num_points);
+    for (const auto &voxel : _voxels) {
+      out.insert(out.end(), voxel.second.points.begin(),
+                 voxel.second.points.end());
+    }
+  }
+
+ private:
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      return size_t(uint32_t(key.x()) * 73856093u ^
+                    uint32_t(key.y()) * 19349669u ^
+                    uint32_t(key.z()) * 83492791u);
+    }
+  };
+
+  static void estimate_plane(Voxel &voxel) {
+    voxel.changed = false;
+    const size_t count = voxel.points.size();
+    if (count < 3) return;
+    Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d second = Eigen::Matrix3d::Zero();
+    for (const auto &point : voxel.points) {
+      const Eigen::Vector3d p = point.cast<double>();
+      mean += p;
+      second += p * p.transpose();
+    }
+    mean /= double(count);
+    const Eigen::Matrix3d covariance =
+        second / double(count) - mean * mean.transpose();
+    // ascending eigenvalues: the first eigenvector is the normal
+    const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+    const Eigen::Matrix3d &U = solver.eigenvectors();
+    voxel.normal = U.col(0);
+    voxel.covariance =
+        U * Eigen::Vector3d(1e-3, 1, 1).asDiagonal() * U.transpose();
+  }
+
+  Params _params;
+  float _inv_voxel_size;
+  std::unordered_map<Key, Voxel, KeyHash> _voxels;
+  size_t _num_points = 0;
+  // voxels changed by the current add()
+  std::vector<Voxel *> _changed;
+};
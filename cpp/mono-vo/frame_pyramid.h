@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/video/tracking.hpp"
+
+// LK window size and number of pyramid levels above the full image
+const cv::Size LK_WIN_SIZE(21, 21);
+const int LK_MAX_LEVEL = 3;
+
+/**
+ * Image pyramid of a frame with the gradient images of every level, as
+ * built by cv::buildOpticalFlowPyramid.
+ *
+ * The pyramid is built once per frame and passed to calcOpticalFlowPyrLK
+ * both as the "next" pyramid of its own tracking step and as the "previous"
+ * pyramid of the following one.
+ */
+class FramePyramid {
+ public:
+  /**
+   * build the pyramid with gradients for LK tracking
+   * @param image grayscale frame
+   */
+  void build(const cv::Mat &image) {
+    _num_levels = cv::buildOpticalFlowPyramid(image, _levels, LK_WIN_SIZE,
+                                              LK_MAX_LEVEL, true) +
+                  1;
+  }
+
+  bool empty() const { return _levels.empty(); }
+
+  /** number of levels, the full-resolution image included */
+  int num_levels() const { return _num_levels; }
+
+  /** interleaved image/gradient levels as accepted by calcOpticalFlowPyrLK */
+  const std::vector<cv::Mat> &levels() const { return _levels; }
+
+  /** image of a level (0 is the full-resolution frame) */
+  const cv::Mat &image(int level) const { return _levels[size_t(2 * level)]; }
+
+  /** Scharr gradients (CV_16SC2, dx and dy) of a level */
+  const cv::Mat &gradients(int level) const {
+    return _levels[size_t(2 * level + 1)];
+  }
+
+ private:
+  std::vector<cv::Mat> _levels;
+  int _num_levels = 0;
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_pyramid.h"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "profiler.h"
+
+/**
+ * Frame loader that decodes and grayscale-converts upcoming frames on
+ * background threads.
+ *
+ * Frames [first, last) are decoded into a ring buffer of `capacity` slots, so
+ * while the caller tracks frame N the workers decode frames N+1..N+capacity.
+ * Frames are always handed out in order. Queue occupancy and the time spent
+ * waiting for a frame are recorded to help size the buffer. Optionally the
+ * LK pyramid of every frame is built by the workers as well.
+ */
+class FrameSource {
+ public:
+  struct Frame {
+    int id = -1;
+    // decoded image as stored on disk (BGR)
+    cv::Mat color;
+    // grayscale image used for tracking
+    cv::Mat gray;
+    // LK pyramid of the grayscale image (if requested)
+    FramePyramid pyramid;
+  };
+
+  struct Stats {
+    // frames handed out by next()
+    size_t frames = 0;
+    // average number of decoded frames waiting when next() was called
+    double mean_occupancy = 0;
+    // number of next() calls that had to wait for a decoder
+    size_t stalls = 0;
+    // total time spent waiting for a decoder
+    double stall_seconds = 0;
+  };
+
+  /**
+   * @param path_of file path of a frame ID
+   * @param first first frame ID
+   * @param last frame ID after the last frame
+   * @param capacity number of frames decoded ahead (ring buffer size)
+   * @param num_threads number of decoder threads
+   * @param build_pyramids build Frame::pyramid on the decoder threads
+   */
+  FrameSource(std::function<std::string(int)> path_of, int first, int last,
+              size_t capacity, size_t num_threads, bool build_pyramids = false)
+      : _path_of(std::move(path_of)),
+        _build_pyramids(build_pyramids),
+        _next_decode(first),
+        _next_read(first),
+        _last(last),
+        _slots(std::max<size_t>(capacity, 1)),
+        _ready(_slots.size(), false) {
+    for (size_t i = 0; i < std::max<size_t>(num_threads, 1); i++) {
+      _workers.emplace_back(&FrameSource::decode_loop, this);
+    }
+  }
+
+  FrameSource(const FrameSource &) = delete;
+  FrameSource &operator=(const FrameSource &) = delete;
+
+  ~FrameSource() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopped = true;
+    }
+    _space.notify_all();
+    for (auto &worker : _workers) worker.join();
+  }
+
+  /**
+   * take the next frame, waiting for its decoder if necessary
+   * @param frame next frame (output)
+   * @return false when all frames have been read
+   */
+  bool next(Frame &frame) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_next_read >= _last) return false;
+
+    const size_t slot = slot_of(_next_read);
+    _occupancy_sum += _num_ready;
+    if (!_ready[slot]) {
+      const auto start = std::chrono::steady_clock::now();
+      _filled.wait(lock, [&] { return bool(_ready[slot]); });
+      _stats.stall_seconds += std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+      _stats.stalls++;
+    }
+
+    frame = std::move(_slots[slot]);
+    _slots[slot] = Frame();
+    _ready[slot] = false;
+    _num_ready--;
+    _next_read++;
+    _stats.frames++;
+    lock.unlock();
+    _space.notify_all();
+
+    if (frame.color.empty()) {
+      throw std::runtime_error("Error reading images");
+    }
+    return true;
+  }
+
+  /** ring buffer size */
+  size_t capacity() const { return _slots.size(); }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Stats stats = _stats;
+    if (stats.frames > 0) {
+      stats.mean_occupancy = double(_occupancy_sum) / double(stats.frames);
+    }
+    return stats;
+  }
+
+ private:
+  size_t slot_of(int frame_id) const {
+    return static_cast<size_t>(frame_id) % _slots.size();
+  }
+
+  void decode_loop() {
+    for (;;) {
+      int frame_id;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        // a slot is free once the frame `capacity` before it has been read
+        _space.wait(lock, [&] {
+          return _stopped || _next_decode >= _last ||
+                 _next_decode < _next_read + int(_slots.size());
+        });
+        if (_stopped || _next_decode >= _last) return;
+        frame_id = _next_decode++;
+      }
+
+      UTILS_PROFILE_SCOPE("decode");
+      Frame frame;
+      frame.id = frame_id;
+      frame.color = cv::imread(_path_of(frame_id));
+      // we work with grayscale images
+      if (!frame.color.empty()) {
+        cv::cvtColor(frame.color, frame.gray, cv::COLOR_BGR2GRAY);
+        if (_build_pyramids) frame.pyramid.build(frame.gray);
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const size_t slot = slot_of(frame_id);
+        _slots[slot] = std::move(frame);
+        _ready[slot] = true;
+        _num_ready++;
+      }
+      _filled.notify_all();
+    }
+  }
+
+  const std::function<std::string(int)> _path_of;
+  const bool _build_pyramids;
+
+  mutable std::mutex _mutex;
+  // signalled when a frame has been decoded
+  std::condition_variable _filled;
+  // signalled when a slot has been released or the source is stopped
+  std::condition_variable _space;
+
+  int _next_decode;
+  int _next_read;
+  const int _last;
+  bool _stopped = false;
+
+  std::vector<Frame> _slots;
+  std::vector<bool> _ready;
+  size_t _num_ready = 0;
+
+  size_t _occupancy_sum = 0;
+  Stats _stats;
+
+  std::vector<std::thread> _workers;
+};
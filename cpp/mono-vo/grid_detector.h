@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/features2d/features2d.hpp"
+
+/**
+ * FAST detection over a grid of tiles with a per-cell feature budget.
+ *
+ * Each cell is detected independently (in parallel) and keeps only its
+ * strongest responses, so features are spread over the image and the total
+ * count never exceeds the budget (max_features / cells per cell, the
+ * remainder going to the first cells). Every cell keeps its own FAST
+ * threshold, adapted from frame to frame towards the threshold that fills
+ * its budget.
+ *
+ * replenish() tops up only the cells that hold fewer live tracks than their
+ * budget, so surviving tracks are kept and well-covered cells cost nothing.
+ * Live tracks are never dropped, but the new points are capped so that
+ * tracks and new points together stay within the budget; if cells holding
+ * more tracks than their share push it over, the weakest new points go.
+ */
+class GridDetector {
+ public:
+  struct Params {
+    int grid_cols = 16;
+    int grid_rows = 6;
+    // total number of features over all cells
+    int max_features = 3000;
+    // FAST thresholds (initial value and range of the per-cell adaptation)
+    int init_threshold = 20;
+    int min_threshold = 7;
+    int max_threshold = 80;
+    // minimum distance (pixels) between a new corner and a live track
+    float min_distance = 10;
+  };
+
+  GridDetector() : GridDetector(Params()) {}
+  explicit GridDetector(const Params &params) : _params(params) {}
+
+  const Params &params() const { return _params; }
+
+  /** number of features a cell may keep (the budgets sum to max_features) */
+  int cell_budget(size_t cell_id) const {
+    const int cells = std::max(_params.grid_cols, 1) *
+                      std::max(_params.grid_rows, 1);
+    return _params.max_features / cells +
+           (int(cell_id) < _params.max_features % cells ? 1 : 0);
+  }
+
+  /** current FAST threshold of every cell (row-major) */
+  const std::vector<int> &thresholds() const { return _thresholds; }
+
+  /**
+   * detect feature points
+   * @param img target image (input)
+   * @param points feature points (output)
+   */
+  void detect(const cv::Mat &img, std::vector<cv::Point2f> &points) {
+    layout(img.size());
+    for (auto &existing : _existing) existing.clear();
+    run(img, _params.max_features, points);
+  }
+
+  /**
+   * detect new feature points only where live tracks are sparse
+   * @param img target image (input)
+   * @param existing positions of live tracks in img (input)
+   * @param points new feature points, away from existing ones (output)
+   */
+  void replenish(const cv::Mat &img, const std::vector<cv::Point2f> &existing,
+                 std::vector<cv::Point2f> &points) {
+    layout(img.size());
+    for (auto &cell_points : _existing) cell_points.clear();
+    for (const auto &point : existing) {
+      const int cell_id = cell_of(point);
+      if (cell_id >= 0) _existing[size_t(cell_id)].push_back(point);
+    }
+    run(img, std::max(_params.max_features - int(existing.size()), 0),
+        points);
+  }
+
+ private:
+  // FAST needs a 3 pixel circle around each candidate
+  static constexpr int kBorder = 3;
+
+  /** @param max_points cap on the new points of all cells */
+  void run(const cv::Mat &img, int max_points,
+           std::vector<cv::Point2f> &points) {
+    cv::parallel_for_(cv::Range(0, int(_cells.size())),
+                      [&](const cv::Range &range) {
+                        for (int c = range.start; c < range.end; c++) {
+                          detect_cell(img, size_t(c));
+                        }
+                      });
+
+    _merged.clear();
+    for (const auto &key_points : _key_points) {
+      _merged.insert(_merged.end(), key_points.begin(), key_points.end());
+    }
+    if (int(_merged.size()) > max_points) {
+      // retainBest keeps ties with the last response; the best come first
+      cv::KeyPointsFilter::retainBest(_merged, max_points);
+      _merged.resize(size_t(max_points));
+    }
+    points.clear();
+    for (const auto &key_point : _merged) points.push_back(key_point.pt);
+  }
+
+  /** @return cell containing the point, or -1 outside the image */
+  int cell_of(const cv::Point2f &point) const {
+    const auto col = std::upper_bound(_col_edges.begin(), _col_edges.end(),
+                                      int(std::floor(point.x)));
+    const auto row = std::upper_bound(_row_edges.begin(), _row_edges.end(),
+                                      int(std::floor(point.y)));
+    if (col == _col_edges.begin() || col == _col_edges.end() ||
+        row == _row_edges.begin() || row == _row_edges.end()) {
+      return -1;
+    }
+    const int cols = int(_col_edges.size()) - 1;
+    return int(row - _row_edges.begin() - 1) * cols +
+           int(col - _col_edges.begin() - 1);
+  }
+
+  /** recompute the cells when the image size changes */
+  void layout(const cv::Size &size) {
+    if (size == _image_size && !_cells.empty()) return;
+    _image_size = size;
+
+    const int cols = std::max(_params.grid_cols, 1);
+    const int rows = std::max(_params.grid_rows, 1);
+    _col_edges.clear();
+    _row_edges.clear();
+    for (int c = 0; c <= cols; c++) _col_edges.push_back(size.width * c / cols);
+    for (int r = 0; r <= rows; r++) _row_edges.push_back(size.height * r / rows);
+
+    _cells.clear();
+    for (int r = 0; r < rows; r++) {
+      for (int c = 0; c < cols; c++) {
+        _cells.emplace_back(_col_edges[size_t(c)], _row_edges[size_t(r)],
+                            _col_edges[size_t(c) + 1] - _col_edges[size_t(c)],
+                            _row_edges[size_t(r) + 1] - _row_edges[size_t(r)]);
+      }
+    }
+    _thresholds.assign(_cells.size(), _params.init_threshold);
+    _key_points.resize(_cells.size());
+    _existing.resize(_cells.size());
+  }
+
+  void detect_cell(const cv::Mat &img, size_t cell_id) {
+    const cv::Rect &cell = _cells[cell_id];
+    const auto &existing = _existing[cell_id];
+    auto &key_points = _key_points[cell_id];
+    // remaining budget of the cell after its live tracks
+    const int budget = cell_budget(cell_id);
+    const int quota = budget - int(existing.size());
+    if (quota <= 0) {
+      key_points.clear();
+      return;
+    }
+
+    // detect on the cell plus a border so corners on cell edges are found
+    const cv::Rect roi =
+        cv::Rect(cell.x - kBorder, cell.y - kBorder, cell.width + 2 * kBorder,
+                 cell.height + 2 * kBorder) &
+        cv::Rect(0, 0, img.cols, img.rows);
+    const cv::Mat tile = img(roi);
+    int &threshold = _thresholds[cell_id];
+
+    fast_in_cell(tile, roi, cell, threshold, key_points);
+    if (int(key_points.size()) < quota && threshold > _params.min_threshold) {
+      // low-texture cell: retry with the lowest threshold
+      fast_in_cell(tile, roi, cell, _params.min_threshold, key_points);
+    }
+
+    // adapt the threshold of the next frame to the response of this one
+    const int found = int(key_points.size());
+    if (found < budget) {
+      threshold = std::max(_params.min_threshold, threshold * 4 / 5);
+    } else if (found > 2 * budget) {
+      threshold = std::min(_params.max_threshold, threshold * 5 / 4 + 1);
+    }
+
+    if (!existing.empty()) {
+      // drop corners that duplicate live tracks
+      const float min_distance2 = _params.min_distance * _params.min_distance;
+      size_t kept = 0;
+      for (const auto &key_point : key_points) {
+        bool near = false;
+        for (const auto &point : existing) {
+          const cv::Point2f d = key_point.pt - point;
+          if (d.dot(d) < min_distance2) {
+            near = true;
+            break;
+          }
+        }
+        if (!near) key_points[kept++] = key_point;
+      }
+      key_points.resize(kept);
+    }
+
+    // keep the strongest responses of the cell
+    cv::KeyPointsFilter::retainBest(key_points, quota);
+  }
+
+  /** FAST on a tile, keeping only corners inside the cell (image coordinates) */
+  static void fast_in_cell(const cv::Mat &tile, const cv::Rect &roi,
+                           const cv::Rect &cell, int threshold,
+                           std::vector<cv::KeyPoint> &key_points) {
+    cv::FAST(tile, key_points, threshold, true);
+    size_t kept = 0;
+    for (auto &key_point : key_points) {
+      key_point.pt.x += float(roi.x);
+      key_point.pt.y += float(roi.y);
+      if (cell.contains(cv::Point(key_point.pt))) key_points[kept++] = key_point;
+    }
+    key_points.resize(kept);
+  }
+
+  Params _params;
+  cv::Size _image_size;
+  std::vector<int> _col_edges;
+  std::vector<int> _row_edges;
+  std::vector<cv::Rect> _cells;
+  std::vector<int> _thresholds;
+  // detection buffers of every cell (kept between frames)
+  std::vector<std::vector<cv::KeyPoint>> _key_points;
+  // live tracks of every cell (replenish only)
+  std::vector<std::vector<cv::Point2f>> _existing;
+  // new points of all cells (kept between frames)
+  std::vector<cv::KeyPoint> _merged;
+};
@@ -0,0 +1,513 @@
+#pragma once
+
+#include <ceres/ceres.h>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/SVD>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "profiler.h"
+
+/**
+ * Keyframe-based sliding-window bundle adjustment running on its own thread.
+ *
+ * The front-end hands over keyframes (pose from frame-to-frame odometry and
+ * the tracked feature observations, keyed by track ID) without waiting. The
+ * backend keeps the last window_size keyframes, triangulates tracks seen by
+ * at least two of them, and jointly refines keyframe poses and landmarks with
+ * Ceres: analytic 2x6 / 2x3 reprojection Jacobians (SizedCostFunction) and a
+ * Schur-complement linear solver with landmarks eliminated first. The oldest
+ * keyframes are held constant to fix the gauge and the monocular scale.
+ *
+ * The front-end odometry itself is never modified. Each optimised window
+ * publishes a correction (optimised pose of its newest keyframe against its
+ * odometry pose) that the front-end applies to the poses it outputs, and new
+ * keyframes are chained onto the optimised window by their odometry motion.
+ */
+class LocalBundleAdjuster {
+ public:
+  struct Params {
+    // pinhole intrinsics (pixels)
+    double focal = 718.8560;
+    double cx = 607.1928, cy = 185.2157;
+    // keyframes in the window, and how many of the oldest stay constant
+    size_t window_size = 10;
+    size_t fixed_keyframes = 2;
+    int max_iterations = 10;
+    ceres::LinearSolverType linear_solver = ceres::DENSE_SCHUR;
+    // Huber loss scale, and error above which a landmark is re-triangulated
+    // (pixels)
+    double huber_pixels = 2.0;
+    double outlier_pixels = 5.0;
+    // minimum angle between the two rays of a new landmark (degrees)
+    double min_parallax_deg = 1.0;
+  };
+
+  /** camera-to-world pose (x_world = R * x_camera + t) */
+  struct Pose {
+    Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d t = Eigen::Vector3d::Zero();
+
+    Pose inverse() const { return {R.transpose(), -(R.transpose() * t)}; }
+    Pose operator*(const Pose &other) const {
+      return {R * other.R, R * other.t + t};
+    }
+  };
+
+  struct Keyframe {
+    int frame_id = -1;
+    // front-end odometry pose
+    Pose pose;
+    // observation i: track track_ids[i] at pixel points[i]
+    std::vector<uint64_t> track_ids;
+    std::vector<Eigen::Vector2d> points;
+  };
+
+  /** result of one window optimisation */
+  struct WindowStats {
+    int frame_id;
+    size_t keyframes, landmarks, residuals;
+    // Ceres cost (half the sum of squared robustified residuals)
+    double initial_cost, final_cost;
+    int iterations;
+    double solve_ms;
+  };
+
+  /** maps odometry poses onto the optimised window */
+  struct Correction {
+    int frame_id = -1;
+    // odometry and optimised pose of the newest keyframe of the window
+    Pose odometry, optimized;
+
+    /** corrected pose of a frame tracked after the keyframe */
+    Pose apply(const Pose &pose) const {
+      return optimized * odometry.inverse() * pose;
+    }
+  };
+
+  /**
+   * reprojection error of a landmark in a keyframe with analytic Jacobians.
+   * Pose block: [omega, t] with world-to-camera R = exp(omega), so that
+   * x_camera = R * X + t; point block: world position X.
+   */
+  class ReprojectionError : public ceres::SizedCostFunction<2, 6, 3> {
+   public:
+    ReprojectionError(const Eigen::Vector2d &observed, double focal, double cx,
+                      double cy)
+        : _observed(observed), _focal(focal), _cx(cx), _cy(cy) {}
+
+    bool Evaluate(double const *const *parameters, double *residuals,
+                  double **jacobians) const override {
+      return evaluate(parameters[0], parameters[1], _observed, _focal, _cx,
+                      _cy, residuals, jacobians ? jacobians[0] : nullptr,
+                      jacobians ? jacobians[1] : nullptr);
+    }
+
+    /**
+     * @param jacobian_pose 2x6 row-major (may be null)
+     * @param jacobian_point 2x3 row-major (may be null)
+     * @return false if the point is behind the camera
+     */
+    static bool evaluate(const double *pose, const double *point,
+                         const Eigen::Vector2d &observed, double focal,
+                         double cx, double cy, double *residuals,
+                         double *jacobian_pose, double *jacobian_point) {
+      const Eigen::Map<const Eigen::Vector3d> omega(pose), t(pose + 3);
+      const Eigen::Map<const Eigen::Vector3d> X(point);
+      const Eigen::Matrix3d R = exp_so3(omega);
+      const Eigen::Vector3d p = R * X + t;
+      if (p.z() <= 1e-6) return false;
+
+      const double inv_z = 1.0 / p.z();
+      residuals[0] = focal * p.x() * inv_z + cx - observed.x();
+      residuals[1] = focal * p.y() * inv_z + cy - observed.y();
+      if (!jacobian_pose && !jacobian_point) return true;
+
+      // d(residual)/d(p)
+      Eigen::Matrix<double, 2, 3> J_p;
+      J_p << focal * inv_z, 0, -focal * p.x() * inv_z * inv_z,  //
+          0, focal * inv_z, -focal * p.y() * inv_z * inv_z;
+      if (jacobian_pose) {
+        Eigen::Map<Eigen::Matrix<double, 2, 6, Eigen::RowMajor>> J(
+            jacobian_pose);
+        // d(exp(omega) X)/d(omega) = -R [X]x Jr(omega)
+        J.leftCols<3>() = -J_p * R * skew(X) * right_jacobian(omega);
+        J.rightCols<3>() = J_p;
+      }
+      if (jacobian_point) {
+        Eigen::Map<Eigen::Matrix<double, 2, 3, Eigen::RowMajor>> J(
+            jacobian_point);
+        J = J_p * R;
+      }
+      return true;
+    }
+
+   private:
+    Eigen::Vector2d _observed;
+    double _focal, _cx, _cy;
+  };
+
+  explicit LocalBundleAdjuster(const Params &params) : _params(params) {
+    _thread = std::thread([this] { run(); });
+  }
+
+  ~LocalBundleAdjuster() { stop(); }
+
+  LocalBundleAdjuster(const LocalBundleAdjuster &) = delete;
+  LocalBundleAdjuster &operator=(const LocalBundleAdjuster &) = delete;
+
+  /** queue a keyframe for the backend (does not wait for the optimisation) */
+  void add_keyframe(Keyframe &&keyframe) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _incoming.push_back(std::move(keyframe));
+    }
+    _added.notify_one();
+  }
+
+  /**
+   * latest correction published by the backend
+   * @return false if there is none newer than the last call
+   */
+  bool poll(Correction &correction) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_has_correction) return false;
+    correction = _correction;
+    _has_correction = false;
+    return true;
+  }
+
+  /** optimise the keyframes still queued, then stop the backend thread */
+  void stop() {
+    if (!_thread.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _added.notify_one();
+    _thread.join();
+  }
+
+  std::vector<WindowStats> stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+  }
+
+  /** summary of the window optimisations */
+  void report(std::ostream &out = std::cout) const {
+    const std::vector<WindowStats> windows = stats();
+    if (windows.empty()) return;
+    std::vector<double> solve_ms;
+    double initial_rms = 0, final_rms = 0;
+    size_t residuals = 0, landmarks = 0;
+    for (const auto &window : windows) {
+      solve_ms.push_back(window.solve_ms);
+      // RMS reprojection error (pixels) from the cost of the window
+      const double n = double(std::max<size_t>(window.residuals, 1));
+      initial_rms += std::sqrt(2 * window.initial_cost / n);
+      final_rms += std::sqrt(2 * window.final_cost / n);
+      residuals += window.residuals;
+      landmarks += window.landmarks;
+    }
+    std::sort(solve_ms.begin(), solve_ms.end());
+    const double n = double(windows.size());
+    out << "Local BA: " << windows.size() << " windows, mean "
+        << double(landmarks) / n << " landmarks / " << double(residuals) / n
+        << " residuals, solve p50 " << solve_ms[solve_ms.size() / 2]
+        << " ms, max " << solve_ms.back() << " ms, RMS error "
+        << initial_rms / n << " -> " << final_rms / n << " px" << std::endl;
+  }
+
+  /** exp map of so(3) */
+  static Eigen::Matrix3d exp_so3(const Eigen::Vector3d &omega) {
+    const double theta = omega.norm();
+    if (theta < 1e-10) return Eigen::Matrix3d::Identity() + skew(omega);
+    return Eigen::AngleAxisd(theta, omega / theta).toRotationMatrix();
+  }
+
+  /** log map of SO(3) */
+  static Eigen::Vector3d log_so3(const Eigen::Matrix3d &R) {
+    const Eigen::AngleAxisd aa(R);
+    return aa.angle() * aa.axis();
+  }
+
+ private:
+  struct KeyframeState {
+    Keyframe keyframe;
+    // optimised camera-to-world pose
+    Pose pose;
+    // Ceres pose block (world-to-camera [omega, t])
+    std::array<double, 6> params;
+  };
+
+  struct Landmark {
+    Eigen::Vector3d X;
+    bool valid = false;
+  };
+
+  static Eigen::Matrix3d skew(const Eigen::Vector3d &v) {
+    Eigen::Matrix3d S;
+    S << 0, -v.z(), v.y(),  //
+        v.z(), 0, -v.x(),   //
+        -v.y(), v.x(), 0;
+    return S;
+  }
+
+  /** right Jacobian of SO(3) */
+  static Eigen::Matrix3d right_jacobian(const Eigen::Vector3d &omega) {
+    const double theta2 = omega.squaredNorm();
+    const Eigen::Matrix3d W = skew(omega);
+    if (theta2 < 1e-10) {
+      return Eigen::Matrix3d::Identity() - 0.5 * W + W * W / 6.0;
+    }
+    const double theta = std::sqrt(theta2);
+    return Eigen::Matrix3d::Identity() - (1 - std::cos(theta)) / theta2 * W +
+           (theta - std::sin(theta)) / (theta2 * theta) * W * W;
+  }
+
+  static std::array<double, 6> to_params(const Pose &pose) {
+    const Pose inv = pose.inverse();
+    const Eigen::Vector3d omega = log_so3(inv.R);
+    return {omega.x(), omega.y(), omega.z(), inv.t.x(), inv.t.y(), inv.t.z()};
+  }
+
+  static Pose from_params(const std::array<double, 6> &params) {
+    const Pose inv{exp_so3(Eigen::Vector3d(params[0], params[1], params[2])),
+                   Eigen::Vector3d(params[3], params[4], params[5])};
+    return inv.inverse();
+  }
+
+  void run() {
+    std::vector<Keyframe> incoming;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _added.wait(lock, [&] { return _stopping || !_incoming.empty(); });
+        if (_incoming.empty()) return;
+        incoming.clear();
+        std::swap(incoming, _incoming);
+      }
+
+      for (auto &keyframe : incoming) insert(std::move(keyframe));
+      optimize();
+    }
+  }
+
+  /** append a keyframe, chained onto the window by its odometry motion */
+  void insert(Keyframe &&keyframe) {
+    KeyframeState state;
+    if (_window.empty()) {
+      state.pose = keyframe.pose;
+    } else {
+      const KeyframeState &last = _window.back();
+      state.pose = last.pose * last.keyframe.pose.inverse() * keyframe.pose;
+    }
+    state.keyframe = std::move(keyframe);
+    _window.push_back(std::move(state));
+    while (_window.size() > _params.window_size) _window.pop_front();
+  }
+
+  /** normalised image coordinates of a pixel */
+  Eigen::Vector3d ray(const Eigen::Vector2d &pixel) const {
+    return Eigen::Vector3d((pixel.x() - _params.cx) / _params.focal,
+                           (pixel.y() - _params.cy) / _params.focal, 1);
+  }
+
+  /**
+   * linear triangulation from two keyframes
+   * @return false for a point behind either camera or with low parallax
+   */
+  bool triangulate(const KeyframeState &a, const Eigen::Vector2d &pixel_a,
+                   const KeyframeState &b, const Eigen::Vector2d &pixel_b,
+                   Eigen::Vector3d &X) const {
+    const Eigen::Vector3d ray_a = a.pose.R * ray(pixel_a);
+    const Eigen::Vector3d ray_b = b.pose.R * ray(pixel_b);
+    const double cos_parallax =
+        ray_a.dot(ray_b) / (ray_a.norm() * ray_b.norm());
+    if (cos_parallax > std::cos(_params.min_parallax_deg * M_PI / 180)) {
+      return false;
+    }
+
+    Eigen::Matrix4d A;
+    auto add_rows = [&](const Pose &pose, const Eigen::Vector2d &pixel,
+                        int row) {
+      const Pose inv = pose.inverse();
+      Eigen::Matrix<double, 3, 4> P;
+      P << inv.R, inv.t;
+      const Eigen::Vector3d x = ray(pixel);
+      A.row(row) = x.x() * P.row(2) - P.row(0);
+      A.row(row + 1) = x.y() * P.row(2) - P.row(1);
+    };
+    add_rows(a.pose, pixel_a, 0);
+    add_rows(b.pose, pixel_b, 2);
+    const Eigen::Vector4d h =
+        Eigen::JacobiSVD<Eigen::Matrix4d>(A, Eigen::ComputeFullV)
+            .matrixV()
+            .col(3);
+    if (std::abs(h.w()) < 1e-12) return false;
+    X = h.head<3>() / h.w();
+
+    const Pose inv_a = a.pose.inverse(), inv_b = b.pose.inverse();
+    return (inv_a.R * X + inv_a.t).z() > 0 && (inv_b.R * X + inv_b.t).z() > 0;
+  }
+
+  void optimize() {
+    if (_window.size() <= _params.fixed_keyframes) return;
+    UTILS_PROFILE_SCOPE("local-ba");
+
+    // observations of every track in the window (keyframe, index)
+    for (auto &entry : _observations) entry.second.clear();
+    for (size_t k = 0; k < _window.size(); k++) {
+      const Keyframe &keyframe = _window[k].keyframe;
+      for (size_t i = 0; i < keyframe.track_ids.size(); i++) {
+        _observations[keyframe.track_ids[i]].emplace_back(k, i);
+      }
+    }
+    // forget tracks that left the window
+    for (auto it = _observations.begin(); it != _observations.end();) {
+      if (it->second.empty()) {
+        _landmarks.erase(it->first);
+        it = _observations.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    for (auto &state : _window) state.params = to_params(state.pose);
+
+    // shared by every residual block (not owned by the problem)
+    ceres::HuberLoss loss(_params.huber_pixels);
+    ceres::Problem::Options problem_options;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    ceres::Problem problem(problem_options);
+    auto ordering = std::make_shared<ceres::ParameterBlockOrdering>();
+
+    size_t num_landmarks = 0, num_residuals = 0;
+    for (auto &entry : _observations) {
+      const auto &observations = entry.second;
+      if (observations.size() < 2) continue;
+      Landmark &landmark = _landmarks[entry.first];
+      if (!landmark.valid) {
+        // first and last keyframe give the widest baseline
+        const KeyframeState &first = _window[observations.front().first];
+        const KeyframeState &last = _window[observations.back().first];
+        landmark.valid = triangulate(
+            first, first.keyframe.points[observations.front().second], last,
+            last.keyframe.points[observations.back().second], landmark.X);
+        if (!landmark.valid) continue;
+      }
+
+      // a point behind any of its cameras would make the solve fail
+      double *point = landmark.X.data();
+      for (const auto &observation : observations) {
+        const KeyframeState &state = _window[observation.first];
+        double residual[2];
+        if (!ReprojectionError::evaluate(
+                state.params.data(), point,
+                state.keyframe.points[observation.second], _params.focal,
+                _params.cx, _params.cy, residual, nullptr, nullptr)) {
+          landmark.valid = false;
+          break;
+        }
+      }
+      if (!landmark.valid) continue;
+
+      for (const auto &observation : observations) {
+        KeyframeState &state = _window[observation.first];
+        problem.AddResidualBlock(
+            new ReprojectionError(state.keyframe.points[observation.second],
+                                  _params.focal, _params.cx, _params.cy),
+            &loss, state.params.data(), point);
+        num_residuals++;
+      }
+      ordering->AddElementToGroup(point, 0);
+      num_landmarks++;
+    }
+    if (num_residuals == 0) return;
+
+    for (size_t k = 0; k < _window.size(); k++) {
+      double *pose = _window[k].params.data();
+      if (!problem.HasParameterBlock(pose)) continue;
+      ordering->AddElementToGroup(pose, 1);
+      if (k < _params.fixed_keyframes) problem.SetParameterBlockConstant(pose);
+    }
+
+    ceres::Solver::Options options;
+    options.linear_solver_type = _params.linear_solver;
+    options.linear_solver_ordering = ordering;
+    options.max_num_iterations = _params.max_iterations;
+    options.num_threads = 1;
+    ceres::Solver::Summary summary;
+    const auto start = std::chrono::steady_clock::now();
+    ceres::Solve(options, &problem, &summary);
+    const double solve_ms = std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+
+    for (auto &state : _window) state.pose = from_params(state.params);
+    reject_outliers();
+
+    const KeyframeState &newest = _window.back();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _correction = {newest.keyframe.frame_id, newest.keyframe.pose, newest.pose};
+    _has_correction = true;
+    _stats.push_back({newest.keyframe.frame_id, _window.size(), num_landmarks,
+                      num_residuals, summary.initial_cost, summary.final_cost,
+                      int(summary.iterations.size()), solve_ms});
+  }
+
+  /** landmarks with a large error are triangulated again next window */
+  void reject_outliers() {
+    const double max_error2 = _params.outlier_pixels * _params.outlier_pixels;
+    for (auto &entry : _observations) {
+      auto it = _landmarks.find(entry.first);
+      if (it == _landmarks.end() || !it->second.valid) continue;
+      for (const auto &observation : entry.second) {
+        const KeyframeState &state = _window[observation.first];
+        double residual[2];
+        const bool in_front = ReprojectionError::evaluate(
+            state.params.data(), it->second.X.data(),
+            state.keyframe.points[observation.second], _params.focal,
+            _params.cx, _params.cy, residual, nullptr, nullptr);
+        if (!in_front ||
+            residual[0] * residual[0] + residual[1] * residual[1] >
+                max_error2) {
+          it->second.valid = false;
+          break;
+        }
+      }
+    }
+  }
+
+  const Params _params;
+
+  // backend thread only
+  std::deque<KeyframeState> _window;
+  std::unordered_map<uint64_t, Landmark> _landmarks;
+  std::unordered_map<uint64_t, std::vector<std::pair<size_t, size_t>>>
+      _observations;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _added;
+  std::vector<Keyframe> _incoming;
+  bool _stopping = false;
+  Correction _correction;
+  bool _has_correction = false;
+  std::vector<WindowStats> _stats;
+
+  std::thread _thread;
+};
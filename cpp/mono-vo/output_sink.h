@@ -0,0 +1,348 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <boost/format.hpp>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "pose_store.h"
+#include "profiler.h"
+#include "spsc_queue.h"
+#include "trajectory_format.h"
+
+/**
+ * Output of the VO loop (trajectory files, log messages and the viewer)
+ * handled on a background thread.
+ *
+ * The tracking thread only moves small records into a lock-free queue; file
+ * formatting, disk writes, drawing and HighGUI calls all happen on the sink
+ * thread, so tracking latency does not depend on disk or display speed.
+ * Poses are never lost: when the queue is full the producer waits for a slot
+ * and the record is counted as delayed. Log messages and viewer images are
+ * dropped instead, and counted as such.
+ *
+ * Trajectories can be written in several formats at once:
+ *  - XYZ: "x y z" per frame (the original results file)
+ *  - KITTI: 3x4 row-major [R|t] per frame
+ *  - TUM: "timestamp tx ty tz qx qy qz qw" per frame
+ * each as buffered text or as compact binary records behind a
+ * PoseStore::Header (magic "XPOS", "KPOS" or "TPOS"). Binary KITTI files
+ * can be loaded back with PoseStore.
+ */
+class OutputSink {
+ public:
+  using Format = TrajectoryFormat;
+
+  struct Output {
+    std::string path;
+    Format format = Format::XYZ;
+    bool binary = false;
+  };
+
+  struct Params {
+    std::vector<Output> outputs;
+    // queue slots between the tracking thread and the sink thread
+    size_t capacity = 1024;
+    // draw the trajectory and show the camera images
+    bool view = false;
+    // destination of log records (nullptr: discard)
+    std::ostream *log = &std::cout;
+  };
+
+  struct Stats {
+    // records handled by the sink thread
+    uint64_t poses = 0, logs = 0, images = 0;
+    // log and image records discarded because the queue was full
+    uint64_t dropped = 0;
+    // pose records that had to wait for a free slot
+    uint64_t delayed = 0;
+    // highest queue occupancy seen by the producer
+    size_t max_queued = 0;
+  };
+
+  /**
+   * open every output and start the sink thread
+   * @throw std::runtime_error if an output cannot be opened
+   */
+  explicit OutputSink(const Params &params)
+      : _params(params), _queue(params.capacity) {
+    for (const auto &output : params.outputs) {
+      _writers.push_back(std::make_unique<TrajectoryWriter>(output));
+    }
+    _thread = std::thread([this] { consume_loop(); });
+  }
+
+  ~OutputSink() { close(); }
+
+  OutputSink(const OutputSink &) = delete;
+  OutputSink &operator=(const OutputSink &) = delete;
+
+  /**
+   * queue the camera pose of a frame
+   * @param R orientation (3x3, CV_64F)
+   * @param t position (3x1, CV_64F)
+   */
+  void pose(int frame_id, double timestamp, const cv::Mat &R,
+            const cv::Mat &t) {
+    Record record;
+    record.type = Record::Type::Pose;
+    record.frame_id = frame_id;
+    record.timestamp = timestamp;
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        record.pose[size_t(4 * r + c)] = R.at<double>(r, c);
+      }
+      record.pose[size_t(4 * r + 3)] = t.at<double>(r);
+    }
+    push(std::move(record), true);
+  }
+
+  /** queue a log line (newline appended by the sink) */
+  void log(std::string message) {
+    Record record;
+    record.type = Record::Type::Log;
+    record.text = std::move(message);
+    push(std::move(record), false);
+  }
+
+  /** queue a camera image for the viewer (shares the pixel buffer) */
+  void image(const cv::Mat &image) {
+    if (!_params.view) return;
+    Record record;
+    record.type = Record::Type::Image;
+    record.image = image;
+    push(std::move(record), false);
+  }
+
+  /** write out every queued record, close the outputs and stop the thread */
+  void close() {
+    if (!_thread.joinable()) return;
+    _closing.store(true, std::memory_order_release);
+    _thread.join();
+    for (auto &writer : _writers) writer->close();
+  }
+
+  Stats stats() const {
+    Stats stats;
+    stats.poses = _poses.load(std::memory_order_relaxed);
+    stats.logs = _logs.load(std::memory_order_relaxed);
+    stats.images = _images.load(std::memory_order_relaxed);
+    stats.dropped = _dropped.load(std::memory_order_relaxed);
+    stats.delayed = _delayed.load(std::memory_order_relaxed);
+    stats.max_queued = _max_queued.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  struct Record {
+    enum class Type { Pose, Log, Image };
+    Type type = Type::Log;
+    int frame_id = 0;
+    double timestamp = 0;
+    // 3x4 row-major [R|t]
+    std::array<double, 12> pose{};
+    std::string text;
+    cv::Mat image;
+  };
+
+  /** one trajectory file */
+  class TrajectoryWriter {
+   public:
+    explicit TrajectoryWriter(const Output &output)
+        : _output(output), _buffer(kBufferSize) {
+      _out.rdbuf()->pubsetbuf(_buffer.data(), std::streamsize(_buffer.size()));
+      _out.open(output.path, output.binary ? std::ios::binary : std::ios::out);
+      if (!_out) throw std::runtime_error("Unable to open " + output.path);
+      if (output.binary) {
+        // the record count is filled in by close()
+        write_header(0);
+      } else {
+        _out << std::setprecision(output.format == Format::XYZ ? 6 : 9);
+      }
+    }
+
+    void write(const Record &record) {
+      const auto &p = record.pose;
+      double values[12];
+      size_t n = 0;
+      switch (_output.format) {
+        case Format::XYZ:
+          values[0] = p[3];
+          values[1] = p[7];
+          values[2] = p[11];
+          n = 3;
+          break;
+        case Format::KITTI:
+          std::copy(p.begin(), p.end(), values);
+          n = 12;
+          break;
+        case Format::TUM: {
+          const Eigen::Matrix3d R =
+              (Eigen::Matrix3d() << p[0], p[1], p[2], p[4], p[5], p[6], p[8],
+               p[9], p[10])
+                  .finished();
+          const Eigen::Quaterniond q(R);
+          const double tum[8] = {record.timestamp, p[3],  p[7],  p[11],
+                                 q.x(),            q.y(), q.z(), q.w()};
+          std::copy(tum, tum + 8, values);
+          n = 8;
+          break;
+        }
+      }
+
+      if (_output.binary) {
+        _out.write(reinterpret_cast<const char *>(values),
+                   std::streamsize(n * sizeof(double)));
+      } else {
+        for (size_t i = 0; i < n; i++) _out << (i ? " " : "") << values[i];
+        _out << '\n';
+      }
+      _count++;
+    }
+
+    void close() {
+      if (!_out.is_open()) return;
+      if (_output.binary) {
+        _out.seekp(0);
+        write_header(_count);
+      }
+      _out.close();
+    }
+
+   private:
+    static constexpr size_t kBufferSize = 1 << 16;
+
+    void write_header(uint64_t count) {
+      PoseStore::Header header{{'K', 'P', 'O', 'S'}, PoseStore::kVersion,
+                               count};
+      if (_output.format == Format::XYZ) header.magic[0] = 'X';
+      if (_output.format == Format::TUM) header.magic[0] = 'T';
+      _out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+
+    Output _output;
+    std::vector<char> _buffer;
+    std::ofstream _out;
+    uint64_t _count = 0;
+  };
+
+  /**
+   * @param wait wait for a free slot instead of dropping the record
+   */
+  void push(Record &&record, bool wait) {
+    if (!_queue.try_push(std::move(record))) {
+      if (!wait) {
+        bump(_dropped);
+        return;
+      }
+      bump(_delayed);
+      while (!_queue.try_push(std::move(record))) std::this_thread::yield();
+    }
+    const size_t queued = _queue.size();
+    if (queued > _max_queued.load(std::memory_order_relaxed)) {
+      _max_queued.store(queued, std::memory_order_relaxed);
+    }
+  }
+
+  void consume_loop() {
+    if (_params.view) {
+      cv::namedWindow("Road facing camera", cv::WINDOW_AUTOSIZE);
+      cv::namedWindow("Trajectory", cv::WINDOW_AUTOSIZE);
+      _traj = cv::Mat::zeros(600, 600, CV_8UC3);
+    }
+
+    Record record;
+    int idle = 0;
+    for (;;) {
+      // records pushed before close() are visible once _closing is
+      const bool closing = _closing.load(std::memory_order_acquire);
+      if (_queue.try_pop(record)) {
+        idle = 0;
+        UTILS_PROFILE_SCOPE("sink");
+        handle(record);
+        continue;
+      }
+      if (closing) break;
+      // back off from spinning to short sleeps while the queue stays empty
+      if (++idle < 64) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+    }
+
+    if (_params.log) _params.log->flush();
+  }
+
+  void handle(const Record &record) {
+    switch (record.type) {
+      case Record::Type::Pose:
+        for (auto &writer : _writers) writer->write(record);
+        if (_params.view) draw_position(record);
+        bump(_poses);
+        break;
+      case Record::Type::Log:
+        if (_params.log) *_params.log << record.text << '\n';
+        bump(_logs);
+        break;
+      case Record::Type::Image:
+        show(record.image);
+        bump(_images);
+        break;
+    }
+  }
+
+  void draw_position(const Record &record) {
+    const double x = record.pose[3], y = record.pose[7], z = record.pose[11];
+    cv::circle(_traj, cv::Point(int(x) + 300, int(z) + 100), 1,
+               CV_RGB(255, 0, 0), 2);
+
+    cv::rectangle(_traj, cv::Point(10, 30), cv::Point(550, 50),
+                  CV_RGB(0, 0, 0), cv::FILLED);
+    const std::string text =
+        (boost::format("Coordinates: x = %02fm y = %02fm z = %02fm") % x % y %
+         z)
+            .str();
+    cv::putText(_traj, text, cv::Point(10, 50), cv::FONT_HERSHEY_PLAIN, 1,
+                cv::Scalar::all(255), 1, 8);
+  }
+
+  void show(const cv::Mat &image) {
+    cv::imshow("Trajectory", _traj);
+    cv::imshow("Road facing camera", image);
+    cv::waitKey(1);
+  }
+
+  /** counters written by one thread only */
+  static void bump(std::atomic<uint64_t> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  Params _params;
+  SpscQueue<Record> _queue;
+  std::vector<std::unique_ptr<TrajectoryWriter>> _writers;
+  std::thread _thread;
+  std::atomic<bool> _closing{false};
+  // sink thread only
+  cv::Mat _traj;
+
+  std::atomic<uint64_t> _poses{0}, _logs{0}, _images{0};
+  std::atomic<uint64_t> _dropped{0}, _delayed{0};
+  std::atomic<size_t> _max_queued{0};
+};
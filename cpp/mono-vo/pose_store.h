@@ -0,0 +1,192 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/**
+ * Ground-truth poses of one KITTI sequence (poses/<seq>.txt).
+ *
+ * The text file is parsed once per process, or a pre-converted binary file
+ * (poses/<seq>.bin, see write_binary) is memory-mapped instead. Every frame
+ * is then an O(1) lookup into a flat array of 3x4 row-major matrices.
+ * Stores are shared through load(), so every run over the same sequence in
+ * a process uses the same index.
+ */
+class PoseStore {
+ public:
+  /** number of values of a KITTI pose line (3x4 row-major [R|t]) */
+  static constexpr size_t kPoseSize = 12;
+
+  /** header of the binary format, followed by count * kPoseSize doubles */
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+  };
+  static constexpr uint32_t kVersion = 1;
+
+  /**
+   * load (or reuse) the pose store of a sequence
+   * @param root_path KITTI odometry root containing poses/
+   * @param sequence sequence ID such as "00"
+   * @return shared, immutable pose store
+   */
+  static std::shared_ptr<const PoseStore> load(const std::string &root_path,
+                                               const std::string &sequence) {
+    const std::string base = root_path + "/poses/" + sequence;
+
+    static std::mutex cache_mutex;
+    static std::map<std::string, std::weak_ptr<const PoseStore>> cache;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (auto cached = cache[base].lock()) return cached;
+
+    std::shared_ptr<PoseStore> store(new PoseStore());
+    if (!store->map_binary(base + ".bin")) store->parse_text(base + ".txt");
+    cache[base] = store;
+    return store;
+  }
+
+  /**
+   * convert a KITTI pose text file to the binary format mapped by load()
+   * @param text_path input poses/<seq>.txt
+   * @param binary_path output poses/<seq>.bin
+   */
+  static void write_binary(const std::string &text_path,
+                           const std::string &binary_path) {
+    PoseStore store;
+    store.parse_text(text_path);
+
+    std::ofstream out(binary_path, std::ios::binary);
+    if (!out) throw std::runtime_error("Unable to open " + binary_path);
+    const Header header{{'K', 'P', 'O', 'S'}, kVersion,
+                        static_cast<uint64_t>(store._count)};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(store._data),
+              static_cast<std::streamsize>(store._count * kPoseSize *
+                                           sizeof(double)));
+    if (!out) throw std::runtime_error("Error writing " + binary_path);
+  }
+
+  PoseStore(const PoseStore &) = delete;
+  PoseStore &operator=(const PoseStore &) = delete;
+
+  ~PoseStore() {
+    if (_mapped) munmap(_mapped, _mapped_size);
+  }
+
+  /** number of frames with a ground-truth pose */
+  size_t size() const { return _count; }
+
+  /** true if the poses are memory-mapped from a binary file */
+  bool is_mapped() const { return _mapped != nullptr; }
+
+  /** camera pose of the frame as a 3x4 [R|t] matrix */
+  cv::Matx34d pose(size_t frame_id) const {
+    return cv::Matx34d(row(frame_id));
+  }
+
+  /** camera position of the frame */
+  cv::Vec3d position(size_t frame_id) const {
+    const double *p = row(frame_id);
+    return cv::Vec3d(p[3], p[7], p[11]);
+  }
+
+  /**
+   * distance travelled between the previous frame and this frame, used as
+   * the absolute scale of the monocular translation
+   * @return 0 for the first frame or frames without ground truth
+   */
+  double scale(size_t frame_id) const {
+    if (frame_id == 0 || frame_id >= _count) return 0;
+    return cv::norm(position(frame_id) - position(frame_id - 1));
+  }
+
+ private:
+  PoseStore() = default;
+
+  const double *row(size_t frame_id) const {
+    if (frame_id >= _count) {
+      throw std::out_of_range("no ground-truth pose for frame " +
+                              std::to_string(frame_id));
+    }
+    return _data + frame_id * kPoseSize;
+  }
+
+  void parse_text(const std::string &path) {
+    std::ifstream file(path);
+    if (!file.is_open()) throw std::runtime_error("Unable to open " + path);
+
+    std::string line;
+    while (getline(file, line)) {
+      if (line.empty()) continue;
+      std::istringstream in(line);
+      for (size_t j = 0; j < kPoseSize; j++) {
+        double value;
+        if (!(in >> value)) {
+          throw std::runtime_error("Malformed pose line in " + path);
+        }
+        _values.push_back(value);
+      }
+    }
+    _data = _values.data();
+    _count = _values.size() / kPoseSize;
+  }
+
+  /** @return false if the binary file does not exist */
+  bool map_binary(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(Header)) {
+      close(fd);
+      throw std::runtime_error("Invalid pose file " + path);
+    }
+    _mapped_size = static_cast<size_t>(st.st_size);
+    void *mapped = mmap(nullptr, _mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) throw std::runtime_error("Unable to map " + path);
+    _mapped = mapped;
+
+    Header header;
+    std::memcpy(&header, _mapped, sizeof(header));
+    const size_t payload = static_cast<size_t>(header.count) * kPoseSize *
+                           sizeof(double);
+    if (std::memcmp(header.magic, "KPOS", 4) != 0 ||
+        header.version != kVersion ||
+        _mapped_size != sizeof(Header) + payload) {
+      throw std::runtime_error("Invalid pose file " + path);
+    }
+    _data = reinterpret_cast<const double *>(static_cast<const char *>(_mapped) +
+                                             sizeof(Header));
+    _count = static_cast<size_t>(header.count);
+    return true;
+  }
+
+  // parsed values when loaded from text
+  std::vector<double> _values;
+  // mapped region when loaded from binary
+  void *_mapped = nullptr;
+  size_t _mapped_size = 0;
+  // kPoseSize values per frame, pointing into _values or _mapped
+  const double *_data = nullptr;
+  size_t _count = 0;
+};
@@ -0,0 +1,496 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <Eigen/LU>
+#include <Eigen/SVD>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+
+/**
+ * Relative pose from calibrated correspondences: five-point RANSAC for the
+ * essential matrix followed by the cheirality test of its four
+ * decompositions.
+ *
+ * Follows the conventions of cv::findEssentialMat / cv::recoverPose: with
+ * points1 and points2 in normalized coordinates, p2^T E p1 = 0 and
+ * X2 = R X1 + t. The output mask marks correspondences that are RANSAC
+ * inliers and lie in front of both cameras, as recoverPose's mask does.
+ *
+ * Correspondences are stored as a 4xN row-major matrix (x1, y1, x2, y2), so
+ * the Sampson error and the cheirality test are evaluated over contiguous
+ * rows and vectorise across points.
+ */
+class RelativePoseEstimator {
+ public:
+  /** (x1, y1, x2, y2) of every correspondence, one row per coordinate */
+  using Correspondences =
+      Eigen::Matrix<double, 4, Eigen::Dynamic, Eigen::RowMajor>;
+
+  struct Params {
+    // inlier threshold on the Sampson distance (normalized coordinates)
+    double threshold = 1e-3;
+    // confidence of the adaptive RANSAC termination
+    double confidence = 0.999;
+    int max_iterations = 1000;
+    // sample from the best-ranked correspondences first (needs a quality)
+    bool prosac = true;
+    // score a fixed set of hypotheses on growing blocks of points,
+    // halving the set after every block (preemptive RANSAC)
+    bool preemptive = false;
+    int preemptive_samples = 64;
+    int preemptive_block = 100;
+    // points further than this (in units of |t|) fail the cheirality test
+    double max_depth = 50;
+  };
+
+  struct Result {
+    Eigen::Matrix3d E = Eigen::Matrix3d::Zero();
+    Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d t = Eigen::Vector3d::Zero();
+    // RANSAC inliers, and inliers that also pass the cheirality test
+    int num_inliers = 0;
+    int num_good = 0;
+    // minimal samples drawn
+    int iterations = 0;
+    bool success = false;
+  };
+
+  RelativePoseEstimator() : RelativePoseEstimator(Params()) {}
+  explicit RelativePoseEstimator(const Params &params)
+      : _params(params), _rng(0) {}
+
+  Params &params() { return _params; }
+
+  /**
+   * estimate the relative pose
+   * @param points correspondences (input)
+   * @param quality per-correspondence cost used for PROSAC ordering, lower is
+   * better (e.g. LK error); may be null
+   * @param mask 1 for inliers passing the cheirality test (output)
+   * @return pose and statistics
+   */
+  Result estimate(const Correspondences &points, const float *quality,
+                  std::vector<uint8_t> &mask) {
+    Result result;
+    const int n = int(points.cols());
+    mask.assign(size_t(n), 0);
+    if (n < kSampleSize) return result;
+
+    order_points(n, quality);
+    if (_params.preemptive) {
+      result.E = preemptive_ransac(points, result.iterations);
+    } else {
+      result.E = adaptive_ransac(points, quality != nullptr, result.iterations);
+    }
+    if (result.iterations == 0 || !result.E.allFinite() || result.E.isZero()) {
+      return result;
+    }
+
+    // inliers of the best model, then the cheirality test of the four
+    // decompositions on them in one pass
+    sampson_errors(points, result.E, _errors);
+    const double thresh2 = _params.threshold * _params.threshold;
+    result.num_inliers = int((_errors <= thresh2).count());
+    select_pose(points, thresh2, result, mask);
+    result.success = result.num_good > 0;
+    return result;
+  }
+
+  /**
+   * five-point minimal solver (Stewenius' Groebner basis formulation)
+   * @param sample 4x5 correspondences
+   * @param solutions up to 10 essential matrices (output)
+   */
+  static void five_point(const Eigen::Matrix<double, 4, 5> &sample,
+                          std::vector<Eigen::Matrix3d> &solutions) {
+    solutions.clear();
+
+    // epipolar constraints on row-major e: p2^T E p1 = 0
+    Eigen::Matrix<double, 9, 9> A = Eigen::Matrix<double, 9, 9>::Zero();
+    for (int i = 0; i < 5; i++) {
+      const double x1 = sample(0, i), y1 = sample(1, i);
+      const double x2 = sample(2, i), y2 = sample(3, i);
+      A.row(i) << x2 * x1, x2 * y1, x2, y2 * x1, y2 * y1, y2, x1, y1, 1;
+    }
+    // E = x X + y Y + z Z + W over the null space
+    const Eigen::JacobiSVD<Eigen::Matrix<double, 9, 9>> svd(A,
+                                                           Eigen::ComputeFullV);
+    const Eigen::Matrix<double, 9, 4> basis = svd.matrixV().rightCols<4>();
+
+    std::array<Poly, 9> e;
+    for (int k = 0; k < 9; k++) {
+      e[size_t(k)] = Poly();
+      e[size_t(k)].c[kX] = basis(k, 0);
+      e[size_t(k)].c[kY] = basis(k, 1);
+      e[size_t(k)].c[kZ] = basis(k, 2);
+      e[size_t(k)].c[kOne] = basis(k, 3);
+    }
+    auto E = [&](int r, int c) -> const Poly & { return e[size_t(3 * r + c)]; };
+
+    // det(E) = 0 and 2 E E^T E - tr(E E^T) E = 0
+    Eigen::Matrix<double, 10, 20> M;
+    const Poly det = E(0, 0) * (E(1, 1) * E(2, 2) - E(1, 2) * E(2, 1)) -
+                     E(0, 1) * (E(1, 0) * E(2, 2) - E(1, 2) * E(2, 0)) +
+                     E(0, 2) * (E(1, 0) * E(2, 1) - E(1, 1) * E(2, 0));
+    M.row(0) = Eigen::Map<const Eigen::Matrix<double, 1, 20>>(det.c.data());
+
+    Poly EEt[3][3];
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        EEt[r][c] = E(r, 0) * E(c, 0) + E(r, 1) * E(c, 1) + E(r, 2) * E(c, 2);
+      }
+    }
+    const Poly trace = EEt[0][0] + EEt[1][1] + EEt[2][2];
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        const Poly EEtE =
+            EEt[r][0] * E(0, c) + EEt[r][1] * E(1, c) + EEt[r][2] * E(2, c);
+        const Poly constraint = EEtE * 2.0 - trace * E(r, c);
+        M.row(1 + 3 * r + c) =
+            Eigen::Map<const Eigen::Matrix<double, 1, 20>>(constraint.c.data());
+      }
+    }
+
+    // reduce the cubic monomials to the quotient basis
+    // (xx, xy, yy, xz, yz, zz, x, y, z, 1)
+    const Eigen::FullPivLU<Eigen::Matrix<double, 10, 10>> lu(M.leftCols<10>());
+    if (!lu.isInvertible()) return;
+    const Eigen::Matrix<double, 10, 10> B = lu.solve(M.rightCols<10>());
+
+    // action matrix of the multiplication by x on the quotient basis
+    Eigen::Matrix<double, 10, 10> action = Eigen::Matrix<double, 10, 10>::Zero();
+    action.row(0) = -B.row(kXXX);
+    action.row(1) = -B.row(kXXY);
+    action.row(2) = -B.row(kXYY);
+    action.row(3) = -B.row(kXXZ);
+    action.row(4) = -B.row(kXYZ);
+    action.row(5) = -B.row(kXZZ);
+    action(6, kXX - 10) = 1;
+    action(7, kXY - 10) = 1;
+    action(8, kXZ - 10) = 1;
+    action(9, kX - 10) = 1;
+
+    const Eigen::EigenSolver<Eigen::Matrix<double, 10, 10>> eigen(action);
+    if (eigen.info() != Eigen::Success) return;
+    for (int s = 0; s < 10; s++) {
+      if (std::abs(eigen.eigenvalues()(s).imag()) > 1e-10) continue;
+      const Eigen::Matrix<double, 10, 1> v = eigen.eigenvectors().col(s).real();
+      if (std::abs(v(9)) < 1e-12) continue;
+      const Eigen::Vector4d xyz1(v(6) / v(9), v(7) / v(9), v(8) / v(9), 1);
+      const Eigen::Matrix<double, 9, 1> E_vec = basis * xyz1;
+      Eigen::Matrix3d E_mat;
+      E_mat << E_vec(0), E_vec(1), E_vec(2), E_vec(3), E_vec(4), E_vec(5),
+          E_vec(6), E_vec(7), E_vec(8);
+      solutions.push_back(E_mat / E_mat.norm());
+    }
+  }
+
+  /**
+   * Sampson distances (squared) of all correspondences to an essential
+   * matrix, evaluated row-wise over the points
+   */
+  static void sampson_errors(const Correspondences &points,
+                             const Eigen::Matrix3d &E, Eigen::ArrayXd &errors) {
+    const auto x1 = points.row(0).transpose().array();
+    const auto y1 = points.row(1).transpose().array();
+    const auto x2 = points.row(2).transpose().array();
+    const auto y2 = points.row(3).transpose().array();
+    const Eigen::ArrayXd Ex1_0 = E(0, 0) * x1 + E(0, 1) * y1 + E(0, 2);
+    const Eigen::ArrayXd Ex1_1 = E(1, 0) * x1 + E(1, 1) * y1 + E(1, 2);
+    const Eigen::ArrayXd Ex1_2 = E(2, 0) * x1 + E(2, 1) * y1 + E(2, 2);
+    const Eigen::ArrayXd Etx2_0 = E(0, 0) * x2 + E(1, 0) * y2 + E(2, 0);
+    const Eigen::ArrayXd Etx2_1 = E(0, 1) * x2 + E(1, 1) * y2 + E(2, 1);
+    const Eigen::ArrayXd num = x2 * Ex1_0 + y2 * Ex1_1 + Ex1_2;
+    errors = num.square() / (Ex1_0.square() + Ex1_1.square() +
+                             Etx2_0.square() + Etx2_1.square());
+  }
+
+ private:
+  static constexpr int kSampleSize = 5;
+
+  // monomials of degree <= 3 in (x, y, z): the cubic ones first, then the
+  // quotient basis used by the action matrix
+  enum Monomial {
+    kXXX, kXXY, kXYY, kYYY, kXXZ, kXYZ, kYYZ, kXZZ, kYZZ, kZZZ,
+    kXX, kXY, kYY, kXZ, kYZ, kZZ, kX, kY, kZ, kOne
+  };
+
+  /** polynomial of degree <= 3 in (x, y, z) */
+  struct Poly {
+    std::array<double, 20> c{};
+
+    Poly operator+(const Poly &o) const {
+      Poly p;
+      for (size_t i = 0; i < 20; i++) p.c[i] = c[i] + o.c[i];
+      return p;
+    }
+    Poly operator-(const Poly &o) const {
+      Poly p;
+      for (size_t i = 0; i < 20; i++) p.c[i] = c[i] - o.c[i];
+      return p;
+    }
+    Poly operator*(double s) const {
+      Poly p;
+      for (size_t i = 0; i < 20; i++) p.c[i] = c[i] * s;
+      return p;
+    }
+    Poly operator*(const Poly &o) const {
+      const auto &table = product_table();
+      Poly p;
+      for (size_t i = 0; i < 20; i++) {
+        for (size_t j = 0; j < 20; j++) {
+          const int k = table[i][j];
+          if (k >= 0) p.c[size_t(k)] += c[i] * o.c[j];
+        }
+      }
+      return p;
+    }
+  };
+
+  /** index of the product of two monomials, -1 above degree 3 */
+  static const std::array<std::array<int, 20>, 20> &product_table() {
+    static const std::array<std::array<int, 20>, 20> table = [] {
+      // exponents of (x, y, z) of every monomial
+      const int exps[20][3] = {{3, 0, 0}, {2, 1, 0}, {1, 2, 0}, {0, 3, 0},
+                               {2, 0, 1}, {1, 1, 1}, {0, 2, 1}, {1, 0, 2},
+                               {0, 1, 2}, {0, 0, 3}, {2, 0, 0}, {1, 1, 0},
+                               {0, 2, 0}, {1, 0, 1}, {0, 1, 1}, {0, 0, 2},
+                               {1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {0, 0, 0}};
+      std::array<std::array<int, 20>, 20> t;
+      for (int i = 0; i < 20; i++) {
+        for (int j = 0; j < 20; j++) {
+          t[size_t(i)][size_t(j)] = -1;
+          for (int k = 0; k < 20; k++) {
+            if (exps[i][0] + exps[j][0] == exps[k][0] &&
+                exps[i][1] + exps[j][1] == exps[k][1] &&
+                exps[i][2] + exps[j][2] == exps[k][2]) {
+              t[size_t(i)][size_t(j)] = k;
+            }
+          }
+        }
+      }
+      return t;
+    }();
+    return table;
+  }
+
+  /** sort correspondences by quality for PROSAC (identity otherwise) */
+  void order_points(int n, const float *quality) {
+    _order.resize(size_t(n));
+    std::iota(_order.begin(), _order.end(), 0);
+    if (quality && _params.prosac) {
+      std::stable_sort(_order.begin(), _order.end(),
+                       [&](int a, int b) { return quality[a] < quality[b]; });
+    }
+  }
+
+  /** gather a minimal sample from ranked indices */
+  void gather(const Correspondences &points, const std::array<int, 5> &ids,
+              Eigen::Matrix<double, 4, 5> &sample) const {
+    for (int i = 0; i < kSampleSize; i++) {
+      sample.col(i) = points.col(_order[size_t(ids[size_t(i)])]);
+    }
+  }
+
+  /** draw k distinct indices from [0, range) into ids[first..first+k) */
+  void draw(int range, int first, int k, std::array<int, 5> &ids) {
+    for (int i = first; i < first + k; i++) {
+      for (;;) {
+        const int id = std::uniform_int_distribution<int>(0, range - 1)(_rng);
+        if (std::find(ids.begin(), ids.begin() + i, id) == ids.begin() + i) {
+          ids[size_t(i)] = id;
+          break;
+        }
+      }
+    }
+  }
+
+  /** RANSAC with adaptive termination and optional PROSAC sampling */
+  Eigen::Matrix3d adaptive_ransac(const Correspondences &points, bool ranked,
+                                  int &iterations) {
+    const int n = int(points.cols());
+    const double thresh2 = _params.threshold * _params.threshold;
+    const bool prosac = ranked && _params.prosac;
+
+    // PROSAC growth schedule (Chum and Matas 2005)
+    int subset = kSampleSize;
+    double T_n = _params.max_iterations;
+    for (int i = 0; i < kSampleSize; i++) {
+      T_n *= double(subset - i) / double(n - i);
+    }
+    double T_n_prime = 1;
+
+    Eigen::Matrix3d best = Eigen::Matrix3d::Zero();
+    int best_count = 0;
+    int max_iterations = _params.max_iterations;
+    std::array<int, 5> ids{};
+    Eigen::Matrix<double, 4, 5> sample;
+
+    for (iterations = 0; iterations < max_iterations;) {
+      iterations++;
+      if (prosac) {
+        if (iterations >= T_n_prime && subset < n) {
+          const double T_next = T_n * double(subset + 1) /
+                                double(subset + 1 - kSampleSize);
+          T_n_prime += std::ceil(T_next - T_n);
+          T_n = T_next;
+          subset++;
+        }
+        if (T_n_prime < iterations) {
+          draw(subset, 0, kSampleSize, ids);
+        } else {
+          // the newest point of the subset is always in the sample
+          ids[0] = subset - 1;
+          draw(subset - 1, 1, kSampleSize - 1, ids);
+        }
+      } else {
+        draw(n, 0, kSampleSize, ids);
+      }
+
+      gather(points, ids, sample);
+      five_point(sample, _solutions);
+      for (const auto &E : _solutions) {
+        sampson_errors(points, E, _errors);
+        const int count = int((_errors <= thresh2).count());
+        if (count > best_count) {
+          best_count = count;
+          best = E;
+          max_iterations = std::min(max_iterations,
+                                    required_iterations(double(count) / n));
+        }
+      }
+    }
+    return best;
+  }
+
+  /** preemptive RANSAC: breadth-first scoring of a fixed hypothesis set */
+  Eigen::Matrix3d preemptive_ransac(const Correspondences &points,
+                                    int &iterations) {
+    const int n = int(points.cols());
+    const double thresh2 = _params.threshold * _params.threshold;
+
+    std::vector<Eigen::Matrix3d> hypotheses;
+    std::array<int, 5> ids{};
+    Eigen::Matrix<double, 4, 5> sample;
+    for (iterations = 0; iterations < _params.preemptive_samples;
+         iterations++) {
+      draw(n, 0, kSampleSize, ids);
+      gather(points, ids, sample);
+      five_point(sample, _solutions);
+      hypotheses.insert(hypotheses.end(), _solutions.begin(), _solutions.end());
+    }
+    if (hypotheses.empty()) return Eigen::Matrix3d::Zero();
+
+    // points are scored in a random order, block by block
+    _shuffled.resize(size_t(n));
+    std::iota(_shuffled.begin(), _shuffled.end(), 0);
+    std::shuffle(_shuffled.begin(), _shuffled.end(), _rng);
+    const int block = std::max(_params.preemptive_block, 1);
+    std::vector<std::pair<int, size_t>> scores(hypotheses.size());
+    for (size_t h = 0; h < hypotheses.size(); h++) scores[h] = {0, h};
+
+    Correspondences chunk(4, block);
+    size_t alive = hypotheses.size();
+    for (int start = 0; start < n && alive > 1; start += block) {
+      const int size = std::min(block, n - start);
+      chunk.resize(4, size);
+      for (int i = 0; i < size; i++) {
+        chunk.col(i) = points.col(_shuffled[size_t(start + i)]);
+      }
+      for (size_t h = 0; h < alive; h++) {
+        sampson_errors(chunk, hypotheses[scores[h].second], _errors);
+        scores[h].first += int((_errors <= thresh2).count());
+      }
+      std::sort(scores.begin(), scores.begin() + long(alive),
+                [](const std::pair<int, size_t> &a,
+                   const std::pair<int, size_t> &b) { return a.first > b.first; });
+      alive = std::max<size_t>(alive / 2, 1);
+    }
+    return hypotheses[scores.front().second];
+  }
+
+  /** iterations needed to draw an all-inlier sample with the confidence */
+  int required_iterations(double inlier_ratio) const {
+    const double p_good = std::pow(inlier_ratio, kSampleSize);
+    if (p_good >= 1.0) return 1;
+    if (p_good <= 0.0) return _params.max_iterations;
+    const double k =
+        std::log(1.0 - _params.confidence) / std::log(1.0 - p_good);
+    return int(std::min<double>(std::ceil(k), _params.max_iterations));
+  }
+
+  /**
+   * cheirality test of the four decompositions of E over the inliers in a
+   * single pass; keeps the decomposition with the most points in front
+   */
+  void select_pose(const Correspondences &points, double thresh2,
+                   Result &result, std::vector<uint8_t> &mask) {
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(
+        result.E, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3d U = svd.matrixU(), V = svd.matrixV();
+    if (U.determinant() < 0) U = -U;
+    if (V.determinant() < 0) V = -V;
+    Eigen::Matrix3d W;
+    W << 0, -1, 0, 1, 0, 0, 0, 0, 1;
+
+    const Eigen::Matrix3d Rs[2] = {U * W * V.transpose(),
+                                   U * W.transpose() * V.transpose()};
+    const Eigen::Vector3d u3 = U.col(2);
+    const Eigen::Matrix3d candidates_R[4] = {Rs[0], Rs[1], Rs[0], Rs[1]};
+    const Eigen::Vector3d candidates_t[4] = {u3, u3, -u3, -u3};
+
+    const int n = int(points.cols());
+    const auto x1 = points.row(0).transpose().array();
+    const auto y1 = points.row(1).transpose().array();
+    const auto x2 = points.row(2).transpose().array();
+    const auto y2 = points.row(3).transpose().array();
+    const Eigen::Array<bool, Eigen::Dynamic, 1> inlier = _errors <= thresh2;
+
+    int best = -1, best_good = -1;
+    for (int c = 0; c < 4; c++) {
+      const Eigen::Matrix3d &R = candidates_R[c];
+      const Eigen::Vector3d &t = candidates_t[c];
+      // R f1 with f1 = (x1, y1, 1)
+      const Eigen::ArrayXd r0 = R(0, 0) * x1 + R(0, 1) * y1 + R(0, 2);
+      const Eigen::ArrayXd r1 = R(1, 0) * x1 + R(1, 1) * y1 + R(1, 2);
+      const Eigen::ArrayXd r2 = R(2, 0) * x1 + R(2, 1) * y1 + R(2, 2);
+      // depth d1 of X1 = d1 f1 from d2 f2 = d1 R f1 + t, via f2 x (.)
+      const Eigen::ArrayXd a0 = y2 * r2 - r1, a1 = r0 - x2 * r2,
+                           a2 = x2 * r1 - y2 * r0;
+      const Eigen::ArrayXd b0 = y2 * t(2) - t(1), b1 = t(0) - x2 * t(2),
+                           b2 = x2 * t(1) - y2 * t(0);
+      const Eigen::ArrayXd d1 = -(a0 * b0 + a1 * b1 + a2 * b2) /
+                                (a0.square() + a1.square() + a2.square());
+      const Eigen::ArrayXd d2 = d1 * r2 + t(2);
+      _good[c] = inlier && d1 > 0 && d1 < _params.max_depth && d2 > 0 &&
+                 d2 < _params.max_depth;
+      const int good = int(_good[c].count());
+      if (good > best_good) {
+        best_good = good;
+        best = c;
+      }
+    }
+
+    result.R = candidates_R[best];
+    result.t = candidates_t[best];
+    result.num_good = best_good;
+    for (int i = 0; i < n; i++) mask[size_t(i)] = _good[best](i) ? 1 : 0;
+  }
+
+  Params _params;
+  std::mt19937 _rng;
+
+  // buffers reused between calls
+  std::vector<int> _order;
+  std::vector<int> _shuffled;
+  std::vector<Eigen::Matrix3d> _solutions;
+  Eigen::ArrayXd _errors;
+  Eigen::Array<bool, Eigen::Dynamic, 1> _good[4];
+};
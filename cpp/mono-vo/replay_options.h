@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trajectory_format.h"
+
+/**
+ * Command line options of the vo replay.
+ *
+ *   vo [--root DIR] [--sequence SEQ] [--first N] [--last N]
+ *      [--headless] [--fps RATE] [--output FILE] [--format xyz|kitti|tum]
+ *      [--binary] [--help]
+ *
+ * In headless mode no window is opened, nothing is drawn and nothing is
+ * printed per frame. --fps replays the frames at a fixed rate as a live
+ * camera would deliver them; without it frames are processed as fast as
+ * possible.
+ */
+struct ReplayOptions {
+  std::string root_path = "/workspace/datasets/KITTI";
+  std::string sequence = "00";
+  // frame range [first, last)
+  int first = 0;
+  int last = 1000;
+  bool headless = false;
+  // target frame rate (0: as fast as possible)
+  double fps = 0;
+  // estimated trajectory and its format (see OutputSink)
+  std::string output = "results1_1.txt";
+  TrajectoryFormat format = TrajectoryFormat::XYZ;
+  bool binary = false;
+  // print the usage and exit
+  bool help = false;
+
+  /** root_path/sequences/sequence */
+  std::string sequence_path() const {
+    return root_path + "/sequences/" + sequence;
+  }
+
+  /**
+   * timestamps of the frames (times.txt of the sequence); frames without one
+   * are assumed to be 0.1 s apart
+   */
+  std::vector<double> timestamps() const {
+    std::vector<double> values;
+    std::ifstream in(sequence_path() + "/times.txt");
+    double timestamp;
+    while (in >> timestamp) values.push_back(timestamp);
+    for (int i = int(values.size()); i < last; i++) values.push_back(0.1 * i);
+    return values;
+  }
+
+  static void print_usage(std::ostream &out, const char *program) {
+    out << "usage: " << program
+        << " [--root DIR] [--sequence SEQ] [--first N] [--last N]"
+           " [--headless] [--fps RATE] [--output FILE]"
+           " [--format xyz|kitti|tum] [--binary] [--help]\n";
+  }
+
+  /**
+   * parse the command line
+   * @throw std::invalid_argument on an unknown option or a bad value
+   */
+  static ReplayOptions parse(int argc, char **argv) {
+    ReplayOptions options;
+    for (int i = 1; i < argc; i++) {
+      const std::string arg = argv[i];
+      auto value = [&]() -> std::string {
+        if (i + 1 >= argc) throw std::invalid_argument(arg + " needs a value");
+        return argv[++i];
+      };
+      auto number = [&](const std::string &text) {
+        char *end = nullptr;
+        const double parsed = std::strtod(text.c_str(), &end);
+        if (text.empty() || *end != '\0') {
+          throw std::invalid_argument("bad value for " + arg + ": " + text);
+        }
+        return parsed;
+      };
+      auto integer = [&](const std::string &text) {
+        char *end = nullptr;
+        errno = 0;
+        const long parsed = std::strtol(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || errno == ERANGE ||
+            parsed < std::numeric_limits<int>::min() ||
+            parsed > std::numeric_limits<int>::max()) {
+          throw std::invalid_argument("bad value for " + arg + ": " + text);
+        }
+        return int(parsed);
+      };
+
+      if (arg == "--help" || arg == "-h") {
+        options.help = true;
+      } else if (arg == "--root") {
+        options.root_path = value();
+      } else if (arg == "--sequence") {
+        options.sequence = value();
+      } else if (arg == "--first") {
+        options.first = integer(value());
+      } else if (arg == "--last") {
+        options.last = integer(value());
+      } else if (arg == "--headless") {
+        options.headless = true;
+      } else if (arg == "--fps") {
+        options.fps = number(value());
+      } else if (arg == "--output") {
+        options.output = value();
+      } else if (arg == "--format") {
+        const std::string format = value();
+        if (format == "xyz") {
+          options.format = TrajectoryFormat::XYZ;
+        } else if (format == "kitti") {
+          options.format = TrajectoryFormat::KITTI;
+        } else if (format == "tum") {
+          options.format = TrajectoryFormat::TUM;
+        } else {
+          throw std::invalid_argument("unknown trajectory format " + format);
+        }
+      } else if (arg == "--binary") {
+        options.binary = true;
+      } else {
+        throw std::invalid_argument("unknown option " + arg);
+      }
+    }
+
+    if (options.first < 0 || options.last < options.first + 2) {
+      throw std::invalid_argument("the frame range needs at least 2 frames");
+    }
+    if (options.fps < 0) throw std::invalid_argument("--fps must be >= 0");
+    return options;
+  }
+};
+
+/**
+ * per-frame latency of the replay loop
+ */
+struct ReplayStats {
+  // from the arrival of a frame (or the start of its processing) to the end
+  // of its processing
+  std::vector<double> latency_ms;
+  // frames that arrived before the previous one was finished (--fps only)
+  int late_frames = 0;
+
+  void print(double elapsed_secs, std::ostream &out = std::cout) const {
+    if (latency_ms.empty()) return;
+    std::vector<double> sorted = latency_ms;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) {
+      const size_t rank = size_t(std::ceil(p * double(sorted.size())));
+      return sorted[std::min(sorted.size() - 1, std::max<size_t>(rank, 1) - 1)];
+    };
+    out << "Processed " << sorted.size() << " frames in " << elapsed_secs
+        << "s (" << double(sorted.size()) / elapsed_secs << " fps)"
+        << std::endl;
+    out << "Frame latency: p50 " << percentile(0.50) << " ms, p95 "
+        << percentile(0.95) << " ms, p99 " << percentile(0.99) << " ms, max "
+        << sorted.back() << " ms";
+    if (late_frames > 0) out << ", " << late_frames << " late frames";
+    out << std::endl;
+  }
+};
+
+/**
+ * replays frames at a fixed rate: frame i arrives at begin + i / fps
+ */
+class FramePacer {
+ public:
+  /** @param fps target frame rate (0: no waiting) */
+  explicit FramePacer(double fps)
+      : _period(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(fps > 0 ? 1.0 / fps : 0))),
+        _paced(fps > 0),
+        _next(std::chrono::steady_clock::now()) {}
+
+  /**
+   * wait for the arrival of the next frame
+   * @return its arrival time (now when not paced)
+   */
+  std::chrono::steady_clock::time_point wait() {
+    const auto now = std::chrono::steady_clock::now();
+    if (!_paced) return now;
+    const auto arrival = _next;
+    _next += _period;
+    if (now < arrival) {
+      std::this_thread::sleep_until(arrival);
+    } else if (_frames > 0) {
+      _late_frames++;
+    }
+    _frames++;
+    return arrival;
+  }
+
+  /** frames that arrived before the previous one was finished */
+  int late_frames() const { return _late_frames; }
+
+ private:
+  const std::chrono::steady_clock::duration _period;
+  const bool _paced;
+  std::chrono::steady_clock::time_point _next;
+  int _frames = 0, _late_frames = 0;
+};
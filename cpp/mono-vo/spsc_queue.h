@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * Bounded lock-free queue for exactly one producer and one consumer thread.
+ *
+ * Slots are allocated once; push moves a value into a slot and pop moves it
+ * out, so element types that keep their buffers on move (cv::Mat, strings
+ * that fit their capacity) cost no allocation once the queue is warm.
+ */
+template <typename T>
+class SpscQueue {
+ public:
+  /** @param capacity number of slots (rounded up to a power of two) */
+  explicit SpscQueue(size_t capacity) {
+    size_t slots = 2;
+    while (slots < capacity) slots *= 2;
+    _slots.resize(slots);
+    _mask = slots - 1;
+  }
+
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  size_t capacity() const { return _slots.size(); }
+
+  /** number of queued values (exact only from the producer or consumer) */
+  size_t size() const {
+    return _tail.load(std::memory_order_acquire) -
+           _head.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /**
+   * producer only
+   * @return false (and leaves value untouched) if the queue is full
+   */
+  bool try_push(T &&value) {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == _slots.size()) {
+      return false;
+    }
+    _slots[tail & _mask] = std::move(value);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * consumer only
+   * @return false if the queue is empty
+   */
+  bool try_pop(T &value) {
+    const size_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) return false;
+    value = std::move(_slots[head & _mask]);
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  std::vector<T> _slots;
+  size_t _mask;
+  // head (read by the consumer) and tail (written by the producer) live on
+  // separate cache lines
+  alignas(64) std::atomic<size_t> _head{0};
+  alignas(64) std::atomic<size_t> _tail{0};
+};
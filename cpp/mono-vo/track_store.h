@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+class TrackStore;
+
+void featureTracking(cv::InputArray img_1, cv::InputArray img_2,
+                     TrackStore &tracks);
+
+/**
+ * Feature tracks in structure-of-arrays form.
+ *
+ * Track i is (prev_points()[i], curr_points()[i], ids()[i], ages()[i]). IDs
+ * are stable over the lifetime of a track, so later stages can follow a
+ * feature across frames. All buffers keep their capacity between frames:
+ * once they have grown to the working set, tracking and compaction do not
+ * allocate.
+ */
+class TrackStore {
+ public:
+  /** number of live tracks */
+  size_t size() const { return _ids.size(); }
+  bool empty() const { return _ids.empty(); }
+
+  /** positions in the previous frame */
+  const std::vector<cv::Point2f> &prev_points() const { return _prev; }
+  /** positions in the current frame (valid after featureTracking) */
+  const std::vector<cv::Point2f> &curr_points() const { return _curr; }
+  /** stable track IDs */
+  const std::vector<uint64_t> &ids() const { return _ids; }
+  /** number of frames each track has been followed */
+  const std::vector<int> &ages() const { return _ages; }
+  /** LK residual of each track in the last tracking step */
+  const std::vector<float> &errors() const { return _err; }
+
+  /** drop every track (buffers keep their capacity) */
+  void clear() {
+    _prev.clear();
+    _curr.clear();
+    _ids.clear();
+    _ages.clear();
+    _err.clear();
+  }
+
+  /**
+   * start new tracks at positions in the previous frame
+   * @param points feature points of the previous frame
+   */
+  void add(const std::vector<cv::Point2f> &points) {
+    for (const auto &point : points) {
+      _prev.push_back(point);
+      _ids.push_back(_next_id++);
+      _ages.push_back(0);
+    }
+    _curr.resize(_prev.size());
+    _err.resize(_prev.size(), 0);
+  }
+
+  /** replace every track with new tracks at the given points */
+  void reset(const std::vector<cv::Point2f> &points) {
+    clear();
+    add(points);
+  }
+
+  /**
+   * make the current positions the previous ones for the next frame
+   */
+  void advance() {
+    std::swap(_prev, _curr);
+    for (auto &age : _ages) age++;
+  }
+
+ private:
+  friend void featureTracking(cv::InputArray img_1, cv::InputArray img_2,
+                              TrackStore &tracks);
+
+  /**
+   * keep only tracks with a valid status in a single in-place pass
+   * @return number of tracks kept
+   */
+  size_t compact() {
+    size_t kept = 0;
+    for (size_t i = 0; i < _status.size(); i++) {
+      if (!_status[i]) continue;
+      if (kept != i) {
+        _prev[kept] = _prev[i];
+        _curr[kept] = _curr[i];
+        _ids[kept] = _ids[i];
+        _ages[kept] = _ages[i];
+        _err[kept] = _err[i];
+      }
+      kept++;
+    }
+    // shrinking keeps the capacity
+    _prev.resize(kept);
+    _curr.resize(kept);
+    _ids.resize(kept);
+    _ages.resize(kept);
+    _err.resize(kept);
+    return kept;
+  }
+
+  std::vector<cv::Point2f> _prev;
+  std::vector<cv::Point2f> _curr;
+  std::vector<uint64_t> _ids;
+  std::vector<int> _ages;
+  std::vector<float> _err;
+  // LK status of the last tracking step (before compaction)
+  std::vector<uchar> _status;
+
+  uint64_t _next_id = 0;
+};
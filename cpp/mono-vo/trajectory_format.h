@@ -0,0 +1,7 @@
+#pragma once
+
+/**
+ * trajectory file formats of OutputSink (see there); kept apart so that
+ * option parsing does not depend on OpenCV
+ */
+enum class TrajectoryFormat { XYZ, KITTI, TUM };
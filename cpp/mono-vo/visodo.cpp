@@ -20,15 +20,41 @@ THE SOFTWARE.
 */
 
 #include <boost/format.hpp>
-
+#include <chrono>
+#include <functional>
+
+#include "frame_source.h"
+#include "grid_detector.h"
+#include "local_ba.h"
+#include "opencv2/core/eigen.hpp"
+#include "output_sink.h"
+#include "pose_store.h"
+#include "profiler.h"
+#include "replay_options.h"
 #include "vo_features.h"
 
 using namespace cv;
 using namespace std;
 
-const int MAX_FRAME = 1000;
-const int MIN_NUM_FEAT = 2000;
-const string root_path = "/workspace/datasets/KITTI";
+const size_t MIN_NUM_FEAT = 2000;
+// detect with bucketed FAST over a grid instead of one global FAST
+const bool GRID_DETECTION = true;
+// total number of features kept by the grid detector
+const int FEATURE_BUDGET = 3000;
+// estimate the relative pose with the five-point RANSAC engine instead of
+// findEssentialMat + recoverPose
+const bool FIVE_POINT_ENGINE = true;
+// also run the other relative pose path every frame and report both
+const bool COMPARE_POSE_SOLVERS = false;
+// frames decoded ahead of tracking, and threads decoding them
+const size_t PREFETCH_FRAMES = 4;
+const size_t DECODE_THREADS = 2;
+// refine keyframe poses with sliding-window bundle adjustment on a backend
+// thread, one keyframe every KEYFRAME_INTERVAL frames
+const bool LOCAL_BA = true;
+const int KEYFRAME_INTERVAL = 5;
+// per-stage latency report (<prefix>.json, .csv and .trace.json)
+const string profile_prefix = "profile";
 
 // TODO: add a function to load these values directly from KITTI's calib files
 // WARNING: different sequences in the KITTI VO dataset have different
@@ -36,169 +62,356 @@ const string root_path = "/workspace/datasets/KITTI";
 const double focal = 718.8560;
 const cv::Point2d pp(607.1928, 185.2157);
 
-// IMP: Change the file directories (4 places) according to where your dataset
-// is saved before running!
-
-double getAbsoluteScale(int frame_id) {
-  ifstream my_file(root_path + "/poses/00.txt");
-  // read line buffer
-  string line;
-  // read line number
-  int i = 0;
-  // current coordinates
-  double x = 0, y = 0, z = 0;
-  // previous coordinates
-  double x_prev, y_prev, z_prev;
-  if (my_file.is_open()) {
-    while ((getline(my_file, line)) && (i <= frame_id)) {
-      z_prev = z;
-      x_prev = x;
-      y_prev = y;
-      std::istringstream in(line);
-      // cout << line << '\n';
-      for (int j = 0; j < 12; j++) {
-        in >> z;
-        if (j == 7) y = z;
-        if (j == 3) x = z;
-      }
-      i++;
-    }
-    my_file.close();
+// the dataset root, sequence and frame range are given on the command line
+// (see replay_options.h)
+
+string image_path(const ReplayOptions &options, int frame_id) {
+  return options.root_path +
+         (boost::format("/sequences/%s/image_2/%06d.png") % options.sequence %
+          frame_id)
+             .str();
+}
+
+void initialize_images(FrameSource &frames, FrameSource::Frame &prevFrame,
+                       FrameSource::Frame &currFrame) {
+  // read the first two frames from the dataset
+  if (!frames.next(prevFrame) || !frames.next(currFrame)) {
+    throw runtime_error("Error reading images");
+  }
+}
+
+void detect_features(GridDetector &detector, const Mat &image,
+                     vector<Point2f> &points) {
+  UTILS_PROFILE_SCOPE("detect");
+  if (GRID_DETECTION) {
+    detector.detect(image, points);
   } else {
-    cout << "Unable to open file";
-    return 0;
+    featureDetection(image, points);
   }
-  // 3D Pythagoras theorem
-  return sqrt((x - x_prev) * (x - x_prev) + (y - y_prev) * (y - y_prev) +
-              (z - z_prev) * (z - z_prev));
 }
 
-void initialize_images(Mat &prevImage, Mat &currImage) {
-  const string filename1(root_path + "/sequences/00/image_2/000000.png");
-  const string filename2(root_path + "/sequences/00/image_2/000001.png");
+/**
+ * add new tracks in the current frame, where tracks are positioned after
+ * TrackStore::advance
+ */
+void replenish_features(GridDetector &detector, const Mat &image,
+                        TrackStore &tracks, vector<Point2f> &points) {
+  UTILS_PROFILE_SCOPE("detect");
+  if (GRID_DETECTION) {
+    // keep live tracks and detect only in cells that have lost theirs
+    detector.replenish(image, tracks.prev_points(), points);
+    tracks.add(points);
+  } else {
+    // new tracks start in the current frame, so no second optical flow
+    featureDetection(image, points);
+    tracks.reset(points);
+  }
+}
 
-  // read the first two frames from the dataset
-  const Mat img_1_c = imread(filename1);
-  const Mat img_2_c = imread(filename2);
+/**
+ * running comparison of the five-point engine against the OpenCV path
+ */
+struct PoseSolverComparison {
+  int frames = 0;
+  double engine_secs = 0, opencv_secs = 0;
+  // angle between the rotations / translation directions (degrees)
+  double rotation_deg = 0, translation_deg = 0;
+  // fraction of correspondences on which the masks agree
+  double mask_agreement = 0;
+
+  void add(const Mat &R1, const Mat &t1, const Mat &mask1, const Mat &R2,
+           const Mat &t2, const Mat &mask2) {
+    const double cos_r = (trace(R1.t() * R2)[0] - 1) / 2;
+    const double cos_t = t1.dot(t2) / (norm(t1) * norm(t2));
+    rotation_deg += acos(max(-1.0, min(1.0, cos_r))) * 180 / CV_PI;
+    translation_deg += acos(max(-1.0, min(1.0, cos_t))) * 180 / CV_PI;
+    if (!mask1.empty() && mask1.total() == mask2.total()) {
+      mask_agreement += double(countNonZero((mask1 != 0) == (mask2 != 0))) /
+                        double(mask1.total());
+    }
+    frames++;
+  }
 
-  if (!img_1_c.data || !img_2_c.data) {
-    throw runtime_error("Error reading images");
+  void print() const {
+    if (frames == 0) return;
+    cout << "Relative pose over " << frames << " frames: engine "
+         << 1e3 * engine_secs / frames << " ms, OpenCV "
+         << 1e3 * opencv_secs / frames << " ms, mean rotation diff "
+         << rotation_deg / frames << " deg, mean translation diff "
+         << translation_deg / frames << " deg, mask agreement "
+         << mask_agreement / frames << endl;
   }
+};
+
+/**
+ * recover R, t and the inlier mask from the current tracks
+ */
+void estimate_pose(RelativePoseEstimator &estimator, const TrackStore &tracks,
+                   Mat &R, Mat &t, Mat &mask,
+                   PoseSolverComparison &comparison) {
+  auto run_engine = [&](Mat &R_out, Mat &t_out, Mat &mask_out) {
+    // the engine selects the pose inside RANSAC, so recoverPose is part of
+    // this zone
+    UTILS_PROFILE_SCOPE("essential-matrix");
+    estimateRelativePose(estimator, tracks.curr_points(), tracks.prev_points(),
+                         &tracks.errors(), focal, pp, R_out, t_out, mask_out);
+  };
+  auto run_opencv = [&](Mat &R_out, Mat &t_out, Mat &mask_out) {
+    Mat E;
+    {
+      UTILS_PROFILE_SCOPE("essential-matrix");
+      E = findEssentialMat(tracks.curr_points(), tracks.prev_points(), focal,
+                           pp, RANSAC, 0.999, 1.0, mask_out);
+    }
+    // 5-point algorithm
+    UTILS_PROFILE_SCOPE("recoverPose");
+    recoverPose(E, tracks.curr_points(), tracks.prev_points(), R_out, t_out,
+                focal, pp, mask_out);
+  };
+  auto timed = [](double &secs, const function<void()> &run) {
+    const auto start = chrono::steady_clock::now();
+    run();
+    secs += chrono::duration<double>(chrono::steady_clock::now() - start)
+                .count();
+  };
+
+  if (!COMPARE_POSE_SOLVERS) {
+    if (FIVE_POINT_ENGINE) {
+      run_engine(R, t, mask);
+    } else {
+      run_opencv(R, t, mask);
+    }
+    return;
+  }
+
+  Mat R_other, t_other, mask_other;
+  if (FIVE_POINT_ENGINE) {
+    timed(comparison.engine_secs, [&] { run_engine(R, t, mask); });
+    timed(comparison.opencv_secs,
+          [&] { run_opencv(R_other, t_other, mask_other); });
+  } else {
+    timed(comparison.opencv_secs, [&] { run_opencv(R, t, mask); });
+    timed(comparison.engine_secs,
+          [&] { run_engine(R_other, t_other, mask_other); });
+  }
+  comparison.add(R, t, mask, R_other, t_other, mask_other);
+}
 
-  // we work with grayscale images
-  cvtColor(img_1_c, prevImage, COLOR_BGR2GRAY);
-  cvtColor(img_2_c, currImage, COLOR_BGR2GRAY);
+LocalBundleAdjuster::Pose to_pose(const Mat &R, const Mat &t) {
+  LocalBundleAdjuster::Pose pose;
+  cv2eigen(R, pose.R);
+  cv2eigen(t, pose.t);
+  return pose;
 }
 
-void write_trajectory(const Mat &t_f, Mat &traj) {
-  const int x = int(t_f.at<double>(0)) + 300;
-  const int y = int(t_f.at<double>(2)) + 100;
-  circle(traj, Point(x, y), 1, CV_RGB(255, 0, 0), 2);
-
-  rectangle(traj, Point(10, 30), Point(550, 50), CV_RGB(0, 0, 0), FILLED);
-
-  const string text =
-      (boost::format("Coordinates: x = %02fm y = %02fm z = %02fm") %
-       t_f.at<double>(0) % t_f.at<double>(1) % t_f.at<double>(2))
-          .str();
-  const int fontFace = FONT_HERSHEY_PLAIN;
-  const double fontScale = 1;
-  const int thickness = 1;
-  const Point textOrg(10, 50);
-  putText(traj, text, textOrg, fontFace, fontScale, Scalar::all(255), thickness,
-          8);
+/**
+ * hand the inlier tracks of the current frame to the bundle adjustment
+ * backend as a keyframe
+ */
+void add_keyframe(LocalBundleAdjuster &ba, int frame_id,
+                  const TrackStore &tracks, const Mat &mask, const Mat &R_f,
+                  const Mat &t_f) {
+  UTILS_PROFILE_SCOPE("keyframe");
+  LocalBundleAdjuster::Keyframe keyframe;
+  keyframe.frame_id = frame_id;
+  keyframe.pose = to_pose(R_f, t_f);
+  const bool masked = !mask.empty() && mask.total() == tracks.size();
+  for (size_t i = 0; i < tracks.size(); i++) {
+    if (masked && !mask.ptr<uchar>()[i]) continue;
+    const Point2f &point = tracks.curr_points()[i];
+    keyframe.track_ids.push_back(tracks.ids()[i]);
+    keyframe.points.emplace_back(point.x, point.y);
+  }
+  ba.add_keyframe(move(keyframe));
 }
 
 int main(int argc, char **argv) {
-  ofstream myfile;
-  myfile.open("results1_1.txt");
+  ReplayOptions options;
+  try {
+    options = ReplayOptions::parse(argc, argv);
+  } catch (const invalid_argument &e) {
+    cerr << e.what() << endl;
+    ReplayOptions::print_usage(cerr, argv[0]);
+    return 1;
+  }
+  if (options.help) {
+    ReplayOptions::print_usage(cout, argv[0]);
+    return 0;
+  }
 
-  Mat prevImage, currImage;
-  initialize_images(prevImage, currImage);
+  utils::Profiler::instance().enable_trace();
+
+  // trajectory, per-frame messages and the viewer are handled on the sink
+  // thread; headless mode discards the messages and shows nothing
+  OutputSink::Params sink_params;
+  sink_params.outputs.push_back(
+      {options.output, options.format, options.binary});
+  sink_params.view = !options.headless;
+  OutputSink sink(sink_params);
+  // per-frame messages are only built when they are shown
+  const bool frame_log = !options.headless;
+  const vector<double> timestamps = options.timestamps();
+
+  // the backend optimises keyframe windows while the front-end keeps
+  // tracking; its corrections are applied to the output poses
+  LocalBundleAdjuster::Params ba_params;
+  ba_params.focal = focal;
+  ba_params.cx = pp.x;
+  ba_params.cy = pp.y;
+  LocalBundleAdjuster ba(ba_params);
+  LocalBundleAdjuster::Correction correction;
+
+  // ground-truth poses are parsed (or mapped) once for the whole run
+  const auto poses = PoseStore::load(options.root_path, options.sequence);
+
+  // frames are decoded, and their LK pyramids built, on background threads
+  // while tracking runs
+  FrameSource frames(
+      [&](int frame_id) { return image_path(options, frame_id); },
+      options.first, options.last, PREFETCH_FRAMES, DECODE_THREADS, true);
+
+  FrameSource::Frame prevFrame, currFrame;
+  {
+    UTILS_PROFILE_SCOPE("load");
+    initialize_images(frames, prevFrame, currFrame);
+  }
 
   // feature detection, tracking
-  vector<Point2f> prevFeatures,
-      currFeatures;  // vectors to store the coordinates of the feature points
-  featureDetection(prevImage, prevFeatures);  // detect features in img_1
-  vector<uchar> status;
-  featureTracking(prevImage, currImage, prevFeatures, currFeatures,
-                  status);  // track those features to img_2
+  GridDetector::Params detector_params;
+  detector_params.max_features = FEATURE_BUDGET;
+  GridDetector detector(detector_params);
+  TrackStore tracks;  // feature tracks between the previous and current frame
+  vector<Point2f> newFeatures;  // detected feature points (buffer reused)
+  detect_features(detector, prevFrame.gray, newFeatures);  // detect in img_1
+  tracks.reset(newFeatures);
+  {
+    UTILS_PROFILE_SCOPE("track");
+    featureTracking(prevFrame.pyramid, currFrame.pyramid,
+                    tracks);  // track those features to img_2
+  }
 
   // recovering the pose and the essential matrix
-  Mat E, R, t, mask;
-  E = findEssentialMat(currFeatures, prevFeatures, focal, pp, RANSAC, 0.999,
-                       1.0, mask);
-  recoverPose(E, currFeatures, prevFeatures, R, t, focal, pp, mask);
+  RelativePoseEstimator::Params pose_params;
+  pose_params.threshold = 1.0 / focal;  // 1 pixel
+  RelativePoseEstimator estimator(pose_params);
+  PoseSolverComparison comparison;
+  Mat R, t, mask;
+  estimate_pose(estimator, tracks, R, t, mask, comparison);
 
-  prevImage = currImage;
-  prevFeatures = currFeatures;
+  prevFrame = currFrame;
+  tracks.advance();
 
   Mat R_f(R.clone());
   Mat t_f(t.clone());
 
-  const clock_t begin = clock();
+  const auto begin = chrono::steady_clock::now();
 
-  namedWindow("Road facing camera",
-              WINDOW_AUTOSIZE);                // Create a window for display.
-  namedWindow("Trajectory", WINDOW_AUTOSIZE);  // Create a window for display.
+  // with --fps, frames arrive at a fixed rate like a live camera
+  FramePacer pacer(options.fps);
+  ReplayStats replay_stats;
+  replay_stats.latency_ms.reserve(size_t(options.last - options.first));
 
-  Mat traj = Mat::zeros(600, 600, CV_8UC3);
-  for (int numFrame = 2; numFrame < MAX_FRAME; numFrame++) {
-    string filename = root_path;
-    filename +=
-        (boost::format("/sequences/00/image_2/%06d.png") % numFrame).str();
-    cout << numFrame << endl;
-
-    const Mat currImage_c = imread(filename);
-    cvtColor(currImage_c, currImage, COLOR_BGR2GRAY);
+  for (;;) {
+    const auto arrival = pacer.wait();
+    UTILS_PROFILE_SCOPE("frame");
+    {
+      UTILS_PROFILE_SCOPE("load");
+      if (!frames.next(currFrame)) break;
+    }
+    const int numFrame = currFrame.id;
+    if (frame_log) sink.log(to_string(numFrame));
 
     // optical flow
-    featureTracking(prevImage, currImage, prevFeatures, currFeatures, status);
-    E = findEssentialMat(currFeatures, prevFeatures, focal, pp, RANSAC, 0.999,
-                         1.0, mask);
+    // the pyramids were built once by the frame source; the current one is
+    // handed forward as the previous pyramid of the next step
+    {
+      UTILS_PROFILE_SCOPE("track");
+      featureTracking(prevFrame.pyramid, currFrame.pyramid, tracks);
+    }
     // 5-point algorithm
-    recoverPose(E, currFeatures, prevFeatures, R, t, focal, pp, mask);
+    estimate_pose(estimator, tracks, R, t, mask, comparison);
 
-    const double scale = getAbsoluteScale(numFrame);
+    const double scale = poses->scale(numFrame);
 
-    cout << "Scale is " << scale << endl;
+    if (frame_log) sink.log("Scale is " + to_string(scale));
 
     if ((scale > 0.1) && (t.at<double>(2) > t.at<double>(0)) &&
         (t.at<double>(2) > t.at<double>(1))) {
       t_f = t_f + scale * (R_f * t);
       R_f = R * R_f;
     } else {
-      cout << "scale below 0.1, or incorrect translation" << endl;
+      if (frame_log) sink.log("scale below 0.1, or incorrect translation");
     }
 
-    // lines for printing results
-    myfile << t_f.at<double>(0) << " " << t_f.at<double>(1) << " "
-           << t_f.at<double>(2) << endl;
-
-    // a redetection is triggered in case the number of feautres being trakced
-    // go below a particular threshold
-    if (prevFeatures.size() < MIN_NUM_FEAT) {
-      cout << "Number of tracked features reduced to " << prevFeatures.size()
-           << endl;
-      cout << "trigerring redection" << endl;
-      featureDetection(prevImage, prevFeatures);
-      featureTracking(prevImage, currImage, prevFeatures, currFeatures, status);
+    if (LOCAL_BA && numFrame % KEYFRAME_INTERVAL == 0) {
+      add_keyframe(ba, numFrame, tracks, mask, R_f, t_f);
     }
 
-    prevImage = currImage.clone();
-    prevFeatures = currFeatures;
+    // each decoded frame owns its buffers, so no copy is needed
+    prevFrame = currFrame;
+    tracks.advance();
+
+    // a replenishment is triggered in case the number of feautres being
+    // trakced go below a particular threshold
+    if (tracks.size() < MIN_NUM_FEAT) {
+      if (frame_log) {
+        sink.log("Number of tracked features reduced to " +
+                 to_string(tracks.size()));
+        sink.log("trigerring replenishment");
+      }
+      replenish_features(detector, prevFrame.pyramid.image(0), tracks,
+                         newFeatures);
+    }
 
-    write_trajectory(t_f, traj);
-    imshow("Trajectory", traj);
-    imshow("Road facing camera", currImage_c);
+    {
+      UTILS_PROFILE_SCOPE("output");
+      // formatting, writing and drawing happen on the sink thread
+      if (LOCAL_BA) {
+        ba.poll(correction);
+        const LocalBundleAdjuster::Pose pose =
+            correction.apply(to_pose(R_f, t_f));
+        Mat R_out, t_out;
+        eigen2cv(pose.R, R_out);
+        eigen2cv(pose.t, t_out);
+        sink.pose(numFrame, timestamps[size_t(numFrame)], R_out, t_out);
+      } else {
+        sink.pose(numFrame, timestamps[size_t(numFrame)], R_f, t_f);
+      }
+      sink.image(currFrame.color);
+    }
 
-    waitKey(1);
+    replay_stats.latency_ms.push_back(
+        chrono::duration<double, milli>(chrono::steady_clock::now() - arrival)
+            .count());
   }
 
-  clock_t end = clock();
-  double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
+  const double elapsed_secs =
+      chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  // drain the output queue and the backend before the summary
+  sink.close();
+  ba.stop();
   cout << "Total time taken: " << elapsed_secs << "s" << endl;
+  replay_stats.late_frames = pacer.late_frames();
+  replay_stats.print(elapsed_secs);
+  ba.report();
+
+  const OutputSink::Stats sink_stats = sink.stats();
+  cout << "Output: " << sink_stats.poses << " poses, " << sink_stats.logs
+       << " log lines, " << sink_stats.images << " images, "
+       << sink_stats.dropped << " dropped, " << sink_stats.delayed
+       << " delayed (max queued " << sink_stats.max_queued << ")" << endl;
+
+  const FrameSource::Stats frame_stats = frames.stats();
+  cout << "Frame queue: mean occupancy " << frame_stats.mean_occupancy << "/"
+       << frames.capacity() << ", " << frame_stats.stalls << " stalls ("
+       << frame_stats.stall_seconds << "s)" << endl;
+
+  comparison.print();
+
+  utils::Profiler::instance().report();
+  utils::Profiler::instance().write_all(profile_prefix);
 
+  cout << "Trajectory written to " << options.output << endl;
   cout << R_f << endl;
   cout << t_f << endl;
 
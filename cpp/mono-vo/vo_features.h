@@ -36,6 +36,10 @@ THE SOFTWARE.
 #include <fstream>
 #include <string>
 
+#include "frame_pyramid.h"
+#include "relative_pose.h"
+#include "track_store.h"
+
 using namespace cv;
 using namespace std;
 
@@ -51,30 +55,57 @@ void featureTracking(const Mat &img_1, const Mat &img_2, vector<Point2f> &points
                      vector<uchar> &status) {
     //this function automatically gets rid of points for which tracking fails
     vector<float> err;
-    Size winSize = Size(21, 21);
     TermCriteria criteria = TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, 30, 0.01);
     calcOpticalFlowPyrLK(img_1, img_2, points1, points2,
-                         status, err, winSize, 3, criteria, 0, 0.001);
+                         status, err, LK_WIN_SIZE, LK_MAX_LEVEL, criteria, 0, 0.001);
 
     //getting rid of points for which the KLT tracking failed or those who have gone outside the frame
-    int indexCorrection = 0;
-    for (int i = 0; i < status.size(); i++) {
-        Point2f pt = points2.at(i - indexCorrection);
-        // invalid optical flow or outside the frame
-        if ((status.at(i) == 0) || (pt.x < 0) || (pt.y < 0)) {
-            if ((pt.x < 0) || (pt.y < 0)) {
-                // define outside points also as invalid
-                status.at(i) = 0;
-            }
-            // remove from feature points list
-            points1.erase(points1.begin() + (i - indexCorrection));
-            points2.erase(points2.begin() + (i - indexCorrection));
-            // shift index because of remove points
-            indexCorrection++;
+    //(compacted in a single pass instead of erasing from the middle)
+    size_t kept = 0;
+    for (size_t i = 0; i < status.size(); i++) {
+        const Point2f pt = points2.at(i);
+        if ((pt.x < 0) || (pt.y < 0)) {
+            // define outside points also as invalid
+            status.at(i) = 0;
         }
+        // invalid optical flow or outside the frame
+        if (status.at(i) == 0) continue;
+        points1[kept] = points1[i];
+        points2[kept] = points2[i];
+        kept++;
+    }
+    points1.resize(kept);
+    points2.resize(kept);
+}
 
+/**
+ * calc optical flow for every live track and remove failed tracks
+ * @param img_1 previous image, or its FramePyramid::levels()
+ * @param img_2 current image, or its FramePyramid::levels()
+ * @param tracks tracks positioned in img_1; on return, the surviving tracks with positions in img_2
+ */
+void featureTracking(InputArray img_1, InputArray img_2, TrackStore &tracks) {
+    // the store's buffers are reused, so this makes no allocation at steady state
+    TermCriteria criteria = TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, 30, 0.01);
+    calcOpticalFlowPyrLK(img_1, img_2, tracks._prev, tracks._curr,
+                         tracks._status, tracks._err, LK_WIN_SIZE, LK_MAX_LEVEL, criteria, 0, 0.001);
+
+    for (size_t i = 0; i < tracks._status.size(); i++) {
+        const Point2f &pt = tracks._curr[i];
+        // define outside points also as invalid
+        if ((pt.x < 0) || (pt.y < 0)) tracks._status[i] = 0;
     }
+    tracks.compact();
+}
 
+/**
+ * calc optical flow between two cached frame pyramids (no pyramid is rebuilt)
+ * @param pyr_1 pyramid of the previous image
+ * @param pyr_2 pyramid of the current image
+ * @param tracks tracks positioned in the previous image; on return, in the current image
+ */
+void featureTracking(const FramePyramid &pyr_1, const FramePyramid &pyr_2, TrackStore &tracks) {
+    featureTracking(pyr_1.levels(), pyr_2.levels(), tracks);
 }
 
 /**
@@ -90,4 +121,47 @@ void featureDetection(const Mat &img_1, vector<Point2f> &points1) {
     FAST(img_1, key_points_1, fast_threshold, non_max_suppression);
 
     KeyPoint::convert(key_points_1, points1, vector<int>());
-}
\ No newline at end of file
+}
+
+/**
+ * recover the relative pose with RelativePoseEstimator; a drop-in for
+ * findEssentialMat(points1, points2, focal, pp, RANSAC, ...) followed by recoverPose
+ * @param estimator five-point RANSAC engine (its threshold is in normalized coordinates)
+ * @param points1 feature points of the first image
+ * @param points2 feature points of the second image
+ * @param errors LK errors used to rank correspondences for PROSAC (may be null)
+ * @param focal focal length
+ * @param pp principal point
+ * @param R rotation (output)
+ * @param t unit translation (output)
+ * @param mask inliers passing the cheirality test (output)
+ * @return number of inliers passing the cheirality test
+ */
+int estimateRelativePose(RelativePoseEstimator &estimator, const vector<Point2f> &points1,
+                         const vector<Point2f> &points2, const vector<float> *errors, double focal,
+                         Point2d pp, Mat &R, Mat &t, Mat &mask) {
+    // buffers reused between frames
+    static thread_local RelativePoseEstimator::Correspondences correspondences;
+    static thread_local std::vector<uint8_t> inliers;
+
+    const long n = long(points1.size());
+    correspondences.resize(4, n);
+    for (long i = 0; i < n; i++) {
+        correspondences(0, i) = (points1[size_t(i)].x - pp.x) / focal;
+        correspondences(1, i) = (points1[size_t(i)].y - pp.y) / focal;
+        correspondences(2, i) = (points2[size_t(i)].x - pp.x) / focal;
+        correspondences(3, i) = (points2[size_t(i)].y - pp.y) / focal;
+    }
+
+    const RelativePoseEstimator::Result result =
+            estimator.estimate(correspondences, errors ? errors->data() : nullptr, inliers);
+
+    R.create(3, 3, CV_64F);
+    t.create(3, 1, CV_64F);
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) R.at<double>(r, c) = result.R(r, c);
+        t.at<double>(r) = result.t(r);
+    }
+    Mat(inliers, false).copyTo(mask);
+    return result.num_good;
+}
@@ -0,0 +1,101 @@
+/**
+ * BinaryVocabulary (cpp/stereo-vo/binary_vocabulary.h) の学習.
+ * KITTI の image_0 から間引いた画像の ORB 特徴で k-majority の語彙木を作り,
+ * ファイルに保存する. 読み直した語彙で学習画像を BowDatabase に登録して
+ * 各画像自身が 1 位で検索されるかを確かめる.
+ *
+ * usage: bow_vocabulary <sequence dir> <output file> [画像の間隔]
+ */
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "binary_vocabulary.h"
+#include "bow_database.h"
+#include "opencv2/features2d.hpp"
+#include "opencv2/imgcodecs.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - begin)
+      .count();
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0]
+              << " <sequence dir> <output file> [step]" << std::endl;
+    return 1;
+  }
+  const std::string output_path = argv[2];
+  const size_t step = argc > 3 ? std::stoul(argv[3]) : 10;
+  if (step == 0) {
+    std::cerr << "step must be positive" << std::endl;
+    return 1;
+  }
+  // 1 画像あたりの特徴数
+  const int num_features = 1000;
+
+  std::vector<cv::String> paths;
+  cv::glob(std::string(argv[1]) + "/image_0/*.png", paths);
+
+  // 特徴抽出
+  auto begin = Clock::now();
+  cv::Ptr<cv::ORB> orb = cv::ORB::create(num_features);
+  std::vector<cv::Mat> images;
+  size_t num_descriptors = 0;
+  for (size_t i = 0; i < paths.size(); i += step) {
+    const cv::Mat gray = cv::imread(paths[i], cv::IMREAD_GRAYSCALE);
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+    orb->detectAndCompute(gray, cv::noArray(), keypoints, descriptors);
+    if (descriptors.empty()) continue;
+    num_descriptors += size_t(descriptors.rows);
+    images.push_back(descriptors);
+  }
+  if (images.empty()) {
+    std::cerr << "No images in " << argv[1] << "/image_0" << std::endl;
+    return 1;
+  }
+  std::cout << images.size() << " images, " << num_descriptors
+            << " descriptors: " << elapsed_ms(begin) << " ms" << std::endl;
+
+  // 学習 (k = 10, 6 段: 最大 100 万語)
+  begin = Clock::now();
+  BinaryVocabulary vocabulary;
+  vocabulary.train(images);
+  vocabulary.save(output_path);
+  std::cout << vocabulary.num_words() << " words, "
+            << vocabulary.num_nodes() << " nodes: " << elapsed_ms(begin)
+            << " ms -> " << output_path << std::endl;
+
+  // 読み直して自己検索
+  BinaryVocabulary loaded;
+  loaded.load(output_path);
+  BowDatabase database(loaded);
+  std::vector<BinaryVocabulary::BowVector> bows(images.size());
+  begin = Clock::now();
+  for (size_t i = 0; i < images.size(); i++) {
+    BinaryVocabulary::FeatureVector features;
+    loaded.transform(images[i], bows[i], &features);
+    database.add(bows[i], features);
+  }
+  std::cout << "transform: " << elapsed_ms(begin) / double(images.size())
+            << " ms/image" << std::endl;
+
+  std::vector<BowDatabase::Result> results;
+  size_t hits = 0;
+  begin = Clock::now();
+  for (size_t i = 0; i < images.size(); i++) {
+    database.query(bows[i], results, 1);
+    if (!results.empty() && results[0].entry == int(i)) hits++;
+  }
+  std::cout << "query: " << elapsed_ms(begin) / double(images.size())
+            << " ms/image, self retrieval " << hits << "/" << images.size()
+            << std::endl;
+  return 0;
+}
@@ -81,7 +81,7 @@ int main() {
     options.linear_solver_type = ceres::DENSE_NORMAL_CHOLESKY;
     options.minimizer_progress_to_stdout = true;
 
-    utils::Timer("Optimization");
+    utils::Timer timer("Optimization");
     // タスクとソルバーを指定して解く
     ceres::Solve(options, &problem, &summary);
   }
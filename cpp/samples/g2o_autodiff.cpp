@@ -150,7 +150,7 @@ int main() {
 
   // 最適化実施
   {
-    utils::Timer("Optimization");
+    utils::Timer timer("Optimization");
     solver.initializeOptimization();
     const uint max_iter_num = 10;
     solver.optimize(max_iter_num);
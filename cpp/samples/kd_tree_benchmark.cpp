@@ -0,0 +1,131 @@
+/**
+ * KdTree (cpp/lidar-odometry/kd_tree.h) と pcl::KdTreeFLANN の比較.
+ * 1k - 1M 点の一様乱数点群で構築時間と kNN / 半径検索のスループットを測る.
+ * 比較は同じ条件 (1 スレッド, 1 クエリずつ, 半径内の全点) で行い,
+ * KdTree のバッチ検索 (スレッドプール, 半径内の近い順 K 点まで) は別の列に示す.
+ */
+#include <pcl/kdtree/kdtree_flann.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "kd_tree.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - begin)
+      .count();
+}
+}  // namespace
+
+int main() {
+  // 検索数・クエリ数
+  const int K = 10;
+  const float radius = 2.0f;
+  const size_t num_queries = 100000;
+
+  std::mt19937 engine(42);
+  std::uniform_real_distribution<float> dist(0.0f, 100.0f);
+
+  std::vector<Eigen::Vector3f> queries(num_queries);
+  for (auto &q : queries) q = {dist(engine), dist(engine), dist(engine)};
+
+  std::cout << std::setw(9) << "points" << std::setw(14) << "build[ms]"
+            << std::setw(14) << "knn[ms]" << std::setw(14) << "radius[ms]"
+            << std::setw(14) << "batch[ms]"
+            << "  (FLANN / KdTree single-threaded, " << num_queries
+            << " queries, K=" << K << ", r=" << radius
+            << "; batch: KdTree knn / radius (K closest) on "
+            << ThreadPool::instance().size() << " threads)" << std::endl;
+
+  for (size_t n = 1000; n <= 1000000; n *= 10) {
+    std::vector<Eigen::Vector3f> points(n);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
+    cloud->resize(n);
+    for (size_t i = 0; i < n; i++) {
+      points[i] = {dist(engine), dist(engine), dist(engine)};
+      (*cloud)[i] = pcl::PointXYZ(points[i].x(), points[i].y(), points[i].z());
+    }
+
+    // FLANN: 1 クエリずつ, 結果は呼び出し毎の vector
+    auto begin = Clock::now();
+    pcl::KdTreeFLANN<pcl::PointXYZ> flann;
+    flann.setInputCloud(cloud);
+    const double flann_build = elapsed_ms(begin);
+
+    std::vector<int> flann_indices(K);
+    std::vector<float> flann_distances(K);
+    double flann_checksum = 0;
+    begin = Clock::now();
+    for (const auto &q : queries) {
+      flann.nearestKSearch(pcl::PointXYZ(q.x(), q.y(), q.z()), K,
+                           flann_indices, flann_distances);
+      flann_checksum += flann_distances.back();
+    }
+    const double flann_knn = elapsed_ms(begin);
+
+    size_t flann_found = 0;
+    begin = Clock::now();
+    for (const auto &q : queries) {
+      flann_found += size_t(flann.radiusSearch(
+          pcl::PointXYZ(q.x(), q.y(), q.z()), radius, flann_indices,
+          flann_distances));
+    }
+    const double flann_radius = elapsed_ms(begin);
+
+    // KdTree: FLANN と同じく 1 クエリずつ
+    begin = Clock::now();
+    KdTree tree(points);
+    const double tree_build = elapsed_ms(begin);
+
+    std::vector<int> indices(K);
+    std::vector<float> distances(K);
+    double tree_checksum = 0;
+    begin = Clock::now();
+    for (const auto &q : queries) {
+      tree.knn(q, K, indices.data(), distances.data());
+      tree_checksum += distances.back();
+    }
+    const double tree_knn = elapsed_ms(begin);
+
+    size_t tree_found = 0;
+    begin = Clock::now();
+    for (const auto &q : queries) {
+      tree_found += tree.radius(q, radius, indices, distances);
+    }
+    const double tree_radius = elapsed_ms(begin);
+
+    // KdTree のバッチ検索: スレッドプール, 結果は事前確保したバッファ
+    std::vector<int> batch_indices(num_queries * K);
+    std::vector<float> batch_distances(num_queries * K);
+    begin = Clock::now();
+    tree.knn_batch(queries.data(), num_queries, K, batch_indices.data(),
+                   batch_distances.data());
+    const double batch_knn = elapsed_ms(begin);
+
+    begin = Clock::now();
+    tree.radius_batch(queries.data(), num_queries, radius, K,
+                      batch_indices.data(), batch_distances.data());
+    const double batch_radius = elapsed_ms(begin);
+
+    // 結果が一致するか (K 番目の距離の総和と半径内の点数で確認)
+    std::cout << std::fixed << std::setprecision(1) << std::setw(9) << n
+              << std::setw(7) << flann_build << "/" << std::setw(6)
+              << tree_build << std::setw(7) << flann_knn << "/"
+              << std::setw(6) << tree_knn << std::setw(7) << flann_radius
+              << "/" << std::setw(6) << tree_radius << std::setw(7)
+              << batch_knn << "/" << std::setw(6) << batch_radius
+              << "  checksum " << std::setprecision(3) << flann_checksum
+              << " / " << tree_checksum << ", found " << flann_found << " / "
+              << tree_found << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace utils {
+/**
+ * @brief レイテンシのヒストグラム.
+ * 16 ns 未満は 1 ns 刻み, それ以上は 1 オクターブを 8 分割した対数スケール
+ * (相対誤差 1/16 以下). 書き込みは所有スレッドのみ, 読み出しは任意スレッド.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr size_t kBuckets = 16 + 60 * 8;
+
+  /** 所有スレッドからのみ呼ぶ (ロック・RMW 命令なし) */
+  void add(uint64_t ns) {
+    bump(_bins[bucket(ns)], 1);
+    bump(_count, 1);
+    bump(_total, ns);
+    if (ns > _max.load(std::memory_order_relaxed)) {
+      _max.store(ns, std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+  uint64_t total() const { return _total.load(std::memory_order_relaxed); }
+  uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+  uint64_t bin(size_t i) const {
+    return _bins[i].load(std::memory_order_relaxed);
+  }
+
+  static size_t bucket(uint64_t ns) {
+    if (ns < 16) return size_t(ns);
+    const int e = 63 - __builtin_clzll(ns);
+    const uint64_t sub = (ns >> (e - 3)) & 7;
+    return size_t(16 + (e - 4) * 8) + size_t(sub);
+  }
+
+  /** バケットの代表値 (中央値) [ns] */
+  static double bucket_value(size_t i) {
+    if (i < 16) return double(i);
+    const int e = int(i - 16) / 8 + 4;
+    const double sub = double((i - 16) % 8);
+    return (8.0 + sub + 0.5) * double(uint64_t(1) << (e - 3));
+  }
+
+ private:
+  static void bump(std::atomic<uint64_t> &value, uint64_t delta) {
+    value.store(value.load(std::memory_order_relaxed) + delta,
+                std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<uint64_t>, kBuckets> _bins{};
+  std::atomic<uint64_t> _count{0};
+  std::atomic<uint64_t> _total{0};
+  std::atomic<uint64_t> _max{0};
+};
+
+/**
+ * @brief ゾーン単位のプロファイラ (Singleton).
+ *
+ * ProfileZone で計測した区間をスレッドごとのバッファに集計する.
+ * 計測はスレッド内で完結し, ロックを取るのは新しいゾーンの初回登録時のみ.
+ * ゾーンは入れ子にでき, 親子関係を含むパス (例: "frame/track") で集計される.
+ * 結果はテキスト・JSON・CSV・Chrome trace 形式 (chrome://tracing) で出力.
+ */
+class Profiler {
+ public:
+  /** 1 スレッドあたりのゾーン数上限 (超過分は集計しない) */
+  static constexpr size_t kMaxZones = 256;
+
+  struct ZoneSummary {
+    std::string path;
+    int depth;
+    uint64_t count;
+    double total_ms, mean_us, p50_us, p95_us, p99_us, max_us;
+  };
+
+  /** (親 ID, 名前) の比較. string_view のキーで検索できる */
+  struct ZoneKeyLess {
+    using is_transparent = void;
+    template <typename A, typename B>
+    bool operator()(const A &a, const B &b) const {
+      if (a.first != b.first) return a.first < b.first;
+      return std::string_view(a.second) < std::string_view(b.second);
+    }
+  };
+
+  /** スレッド固有のデータ. 所有スレッドのみが書き込む */
+  struct ThreadData {
+    struct TraceEvent {
+      int zone;
+      uint64_t start_ns, duration_ns;
+    };
+
+    int tid = 0;
+    // 計測中のゾーン ID のスタック
+    std::vector<int> stack;
+    // (親 ID, 名前) -> ゾーン ID のキャッシュ
+    std::map<std::pair<int, std::string>, int, ZoneKeyLess> cache;
+    std::array<std::atomic<LatencyHistogram *>, kMaxZones> zones{};
+    std::vector<std::unique_ptr<LatencyHistogram>> owned;
+    // Chrome trace 用のイベント (有効時のみ)
+    std::unique_ptr<TraceEvent[]> events;
+    size_t event_capacity = 0;
+    std::atomic<size_t> num_events{0};
+  };
+
+  static Profiler &instance() {
+    static Profiler profiler;
+    return profiler;
+  }
+
+  /** 呼び出しスレッドのデータ (初回に登録) */
+  ThreadData &thread_data() {
+    thread_local std::shared_ptr<ThreadData> data = [this] {
+      auto d = std::make_shared<ThreadData>();
+      std::lock_guard<std::mutex> lock(_mutex);
+      d->tid = int(_threads.size());
+      _threads.push_back(d);
+      return d;
+    }();
+    return *data;
+  }
+
+  /**
+   * Chrome trace 用に区間を記録する
+   * @param max_events_per_thread スレッドあたりの記録数上限
+   */
+  void enable_trace(size_t max_events_per_thread = size_t(1) << 20) {
+    _trace_capacity.store(max_events_per_thread, std::memory_order_relaxed);
+  }
+
+  /** プロファイラ起動からの経過時間 [ns] */
+  uint64_t now_ns() const {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - _epoch)
+                        .count());
+  }
+
+  /** ゾーンの開始 (ProfileZone から呼ぶ) */
+  int begin(std::string_view name) {
+    ThreadData &data = thread_data();
+    const int parent = data.stack.empty() ? -1 : data.stack.back();
+    auto it = data.cache.find(std::make_pair(parent, name));
+    int id;
+    if (it != data.cache.end()) {
+      id = it->second;
+    } else {
+      id = register_zone(parent, name);
+      data.cache.emplace(std::make_pair(parent, std::string(name)), id);
+    }
+    data.stack.push_back(id);
+    return id;
+  }
+
+  /** ゾーンの終了 (ProfileZone から呼ぶ) */
+  void end(int id, uint64_t start_ns, uint64_t duration_ns) {
+    ThreadData &data = thread_data();
+    data.stack.pop_back();
+    if (id < 0 || size_t(id) >= kMaxZones) return;
+
+    LatencyHistogram *histogram =
+        data.zones[size_t(id)].load(std::memory_order_relaxed);
+    if (!histogram) {
+      data.owned.push_back(std::make_unique<LatencyHistogram>());
+      histogram = data.owned.back().get();
+      data.zones[size_t(id)].store(histogram, std::memory_order_release);
+    }
+    histogram->add(duration_ns);
+
+    const size_t capacity = _trace_capacity.load(std::memory_order_relaxed);
+    if (capacity == 0) return;
+    if (!data.events) {
+      data.events.reset(new ThreadData::TraceEvent[capacity]);
+      data.event_capacity = capacity;
+    }
+    const size_t n = data.num_events.load(std::memory_order_relaxed);
+    if (n < data.event_capacity) {
+      data.events[n] = {id, start_ns, duration_ns};
+      data.num_events.store(n + 1, std::memory_order_release);
+    }
+  }
+
+  /** 全スレッドを合算したゾーン毎の統計 (パス順) */
+  std::vector<ZoneSummary> summary() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<ZoneSummary> result;
+    for (size_t id = 0; id < _zones.size() && id < kMaxZones; id++) {
+      std::vector<uint64_t> bins(LatencyHistogram::kBuckets, 0);
+      uint64_t count = 0, total = 0, max = 0;
+      for (const auto &thread : _threads) {
+        const LatencyHistogram *histogram =
+            thread->zones[id].load(std::memory_order_acquire);
+        if (!histogram) continue;
+        for (size_t i = 0; i < bins.size(); i++) bins[i] += histogram->bin(i);
+        count += histogram->count();
+        total += histogram->total();
+        max = std::max(max, histogram->max());
+      }
+      if (count == 0) continue;
+
+      auto percentile = [&](double p) {
+        const auto rank = uint64_t(std::ceil(p * double(count)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bins.size(); i++) {
+          seen += bins[i];
+          if (seen >= std::max<uint64_t>(rank, 1)) {
+            return std::min(LatencyHistogram::bucket_value(i), double(max)) *
+                   1e-3;
+          }
+        }
+        return double(max) * 1e-3;
+      };
+      result.push_back({_zones[id].path, _zones[id].depth, count,
+                        double(total) * 1e-6,
+                        double(total) * 1e-3 / double(count), percentile(0.50),
+                        percentile(0.95), percentile(0.99), double(max) * 1e-3});
+    }
+    std::sort(result.begin(), result.end(),
+              [](const ZoneSummary &a, const ZoneSummary &b) {
+                return a.path < b.path;
+              });
+    return result;
+  }
+
+  /** 表形式で出力 */
+  void report(std::ostream &out = std::cout) const {
+    out << std::left << std::setw(40) << "zone" << std::right << std::setw(10)
+        << "count" << std::setw(12) << "total[ms]" << std::setw(11)
+        << "mean[us]" << std::setw(11) << "p50[us]" << std::setw(11)
+        << "p95[us]" << std::setw(11) << "p99[us]" << std::setw(11)
+        << "max[us]" << "\n";
+    out << std::fixed << std::setprecision(1);
+    for (const auto &zone : summary()) {
+      const std::string name =
+          std::string(size_t(2 * zone.depth), ' ') + leaf(zone.path);
+      out << std::left << std::setw(40) << name << std::right << std::setw(10)
+          << zone.count << std::setw(12) << zone.total_ms << std::setw(11)
+          << zone.mean_us << std::setw(11) << zone.p50_us << std::setw(11)
+          << zone.p95_us << std::setw(11) << zone.p99_us << std::setw(11)
+          << zone.max_us << "\n";
+    }
+    out << std::defaultfloat;
+  }
+
+  void write_csv(const std::string &path) const {
+    std::ofstream out(path);
+    out << "zone,count,total_ms,mean_us,p50_us,p95_us,p99_us,max_us\n";
+    for (const auto &zone : summary()) {
+      out << zone.path << "," << zone.count << "," << zone.total_ms << ","
+          << zone.mean_us << "," << zone.p50_us << "," << zone.p95_us << ","
+          << zone.p99_us << "," << zone.max_us << "\n";
+    }
+  }
+
+  void write_json(const std::string &path) const {
+    std::ofstream out(path);
+    out << "{\"zones\": [";
+    bool first = true;
+    for (const auto &zone : summary()) {
+      out << (first ? "\n" : ",\n") << "  {\"zone\": \"" << zone.path
+          << "\", \"count\": " << zone.count
+          << ", \"total_ms\": " << zone.total_ms
+          << ", \"mean_us\": " << zone.mean_us << ", \"p50_us\": " << zone.p50_us
+          << ", \"p95_us\": " << zone.p95_us << ", \"p99_us\": " << zone.p99_us
+          << ", \"max_us\": " << zone.max_us << "}";
+      first = false;
+    }
+    out << "\n]}\n";
+  }
+
+  /** Chrome trace (chrome://tracing, Perfetto) 形式. enable_trace() が必要 */
+  void write_chrome_trace(const std::string &path) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::ofstream out(path);
+    out << "{\"traceEvents\": [";
+    bool first = true;
+    out << std::fixed << std::setprecision(3);
+    for (const auto &thread : _threads) {
+      const size_t n = thread->num_events.load(std::memory_order_acquire);
+      for (size_t i = 0; i < n; i++) {
+        const auto &event = thread->events[i];
+        out << (first ? "\n" : ",\n") << "  {\"name\": \""
+            << leaf(_zones[size_t(event.zone)].path)
+            << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << thread->tid
+            << ", \"ts\": " << double(event.start_ns) * 1e-3
+            << ", \"dur\": " << double(event.duration_ns) * 1e-3 << "}";
+        first = false;
+      }
+    }
+    out << "\n]}\n";
+  }
+
+  /** <prefix>.json, <prefix>.csv, <prefix>.trace.json を出力 */
+  void write_all(const std::string &prefix) const {
+    write_json(prefix + ".json");
+    write_csv(prefix + ".csv");
+    write_chrome_trace(prefix + ".trace.json");
+  }
+
+ private:
+  struct ZoneInfo {
+    std::string path;
+    int depth;
+  };
+
+  Profiler() : _epoch(std::chrono::steady_clock::now()) {}
+
+  static std::string leaf(const std::string &path) {
+    const size_t pos = path.rfind('/');
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+  }
+
+  int register_zone(int parent, std::string_view name) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const std::string path =
+        parent < 0 ? std::string(name)
+                   : _zones[size_t(parent)].path + "/" + std::string(name);
+    auto it = _zone_ids.find(path);
+    if (it != _zone_ids.end()) return it->second;
+    const int id = int(_zones.size());
+    _zones.push_back(
+        {path, parent < 0 ? 0 : _zones[size_t(parent)].depth + 1});
+    _zone_ids.emplace(path, id);
+    return id;
+  }
+
+  const std::chrono::steady_clock::time_point _epoch;
+  std::atomic<size_t> _trace_capacity{0};
+
+  mutable std::mutex _mutex;
+  std::vector<ZoneInfo> _zones;
+  std::map<std::string, int> _zone_ids;
+  std::vector<std::shared_ptr<ThreadData>> _threads;
+};
+
+/**
+ * @brief 計測区間. スコープを抜けるまでの時間を Profiler に記録する.
+ * 一時オブジェクトでは何も計測できないため UTILS_PROFILE_SCOPE を使う.
+ */
+class ProfileZone {
+ public:
+  explicit ProfileZone(std::string_view name)
+      : _id(Profiler::instance().begin(name)),
+        _start_ns(Profiler::instance().now_ns()) {}
+  ~ProfileZone() {
+    Profiler::instance().end(_id, _start_ns, elapsed_ns());
+  }
+
+  ProfileZone(const ProfileZone &) = delete;
+  ProfileZone &operator=(const ProfileZone &) = delete;
+
+  /** 開始からの経過時間 [ns] */
+  uint64_t elapsed_ns() const {
+    return Profiler::instance().now_ns() - _start_ns;
+  }
+
+ private:
+  int _id;
+  uint64_t _start_ns;
+};
+}  // namespace utils
+
+#define UTILS_PROFILE_CONCAT_IMPL(a, b) a##b
+#define UTILS_PROFILE_CONCAT(a, b) UTILS_PROFILE_CONCAT_IMPL(a, b)
+/** 現在のスコープを name というゾーンとして計測する */
+#define UTILS_PROFILE_SCOPE(name) \
+  ::utils::ProfileZone UTILS_PROFILE_CONCAT(_profile_zone_, __LINE__)(name)
@@ -8,27 +8,30 @@
 #include <iostream>
 #include <string>
 
+#include "profiler.h"
+
 namespace utils {
 /**
  * @brief タイマークラス. ローカルスコープ内で使用して処理時間を計測.
+ * 計測値は同名のゾーンとして Profiler にも集計される.
+ * 一時オブジェクト (utils::Timer("...");) は即座に破棄されるので必ず変数にする.
  */
 class Timer {
  public:
-  Timer(const std::string& description) : _description(description) {
-    _start_time = std::chrono::system_clock::now();
-  }
+  explicit Timer(const std::string& description)
+      : _description(description), _zone(description) {}
   ~Timer() {
-    const auto end = std::chrono::system_clock::now();
-    const auto dur = end - _start_time;
-    const auto msec =
-        std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
+    const auto msec = _zone.elapsed_ns() / 1000000;
     // インスタンス破棄時に結果出力
     std::cout << "[" << _description << "]: " << msec << " ms\n";
   }
 
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
  private:
   std::string _description;
-  std::chrono::system_clock::time_point _start_time;
+  ProfileZone _zone;
 };
 
 /**
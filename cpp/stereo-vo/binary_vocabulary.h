@@ -0,0 +1,415 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/**
+ * Vocabulary tree of 256-bit binary descriptors (ORB) for bag-of-words
+ * place recognition, after DBoW2 (D. Galvez-Lopez and J. D. Tardos, "Bags
+ * of Binary Words for Fast Place Recognition in Image Sequences", T-RO
+ * 2012).
+ *
+ * - train(): hierarchical k-majority clustering (k-means++ seeds, Hamming
+ *   distance, bitwise majority centres) to `levels` levels; the leaves are
+ *   the words, weighted by their inverse document frequency
+ * - transform(): each descriptor descends the tree by its Hamming distance
+ *   to the children (4 popcounts each); the result is the L1-normalised
+ *   TF-IDF vector of the image and, optionally, its direct index: the
+ *   features grouped by their node `direct_level` levels above the leaves,
+ *   so that matching two images compares only features of the same node
+ * - save() / load(): flat binary file, one 41-byte record per node
+ */
+class BinaryVocabulary {
+ public:
+  static constexpr int kBytes = 32;
+
+  struct Descriptor {
+    uint64_t bits[kBytes / 8];
+  };
+
+  /** (word, weight) sorted by word */
+  using BowVector = std::vector<std::pair<uint32_t, float>>;
+  /** (node, feature indices) sorted by node */
+  using FeatureVector = std::vector<std::pair<uint32_t, std::vector<int>>>;
+
+  struct Params {
+    // branching factor
+    int k = 10;
+    // depth of the leaves
+    int levels = 6;
+    // k-majority iterations per node
+    int max_iterations = 10;
+  };
+
+  BinaryVocabulary() : BinaryVocabulary(Params()) {}
+  explicit BinaryVocabulary(const Params &params) : _params(params) {}
+
+  const Params &params() const { return _params; }
+  size_t num_words() const { return _words.size(); }
+  size_t num_nodes() const { return _nodes.size(); }
+  bool empty() const { return _words.empty(); }
+
+  static Descriptor descriptor(const uint8_t *row) {
+    Descriptor d;
+    std::memcpy(d.bits, row, kBytes);
+    return d;
+  }
+  static int distance(const Descriptor &a, const Descriptor &b) {
+    int d = 0;
+    for (int i = 0; i < kBytes / 8; i++) {
+      d += __builtin_popcountll(a.bits[i] ^ b.bits[i]);
+    }
+    return d;
+  }
+
+  /**
+   * @param images descriptors of each training image (CV_8U, 32 columns,
+   *               one row per feature)
+   */
+  void train(const std::vector<cv::Mat> &images) {
+    if (_params.k < 2 || _params.k > 255 || _params.levels < 1) {
+      throw std::invalid_argument("Invalid vocabulary parameters");
+    }
+    std::vector<Descriptor> descriptors;
+    for (const auto &image : images) {
+      check(image);
+      for (int r = 0; r < image.rows; r++) {
+        descriptors.push_back(descriptor(image.ptr<uint8_t>(r)));
+      }
+    }
+
+    _nodes.assign(1, Node());
+    _words.clear();
+    std::vector<uint32_t> indices(descriptors.size());
+    for (uint32_t i = 0; i < indices.size(); i++) indices[i] = i;
+    std::mt19937 engine(0);
+    if (!indices.empty()) cluster(0, descriptors, indices, 1, engine);
+
+    // leaves in node order are the words
+    for (uint32_t n = 0; n < _nodes.size(); n++) {
+      if (_nodes[n].num_children == 0 && n > 0) {
+        _nodes[n].word = uint32_t(_words.size());
+        _words.push_back(n);
+      }
+    }
+
+    // idf = log(N / number of images with the word)
+    std::vector<uint32_t> documents(_words.size(), 0), last(_words.size(), 0);
+    for (uint32_t i = 0; i < images.size(); i++) {
+      for (int r = 0; r < images[i].rows; r++) {
+        const uint32_t word =
+            _nodes[leaf(descriptor(images[i].ptr<uint8_t>(r)))].word;
+        if (documents[word] == 0 || last[word] != i) {
+          documents[word]++;
+          last[word] = i;
+        }
+      }
+    }
+    for (size_t w = 0; w < _words.size(); w++) {
+      _nodes[_words[w]].weight =
+          documents[w] > 0
+              ? float(std::log(double(images.size()) / double(documents[w])))
+              : 0.f;
+    }
+  }
+
+  /**
+   * @param descriptors CV_8U, 32 columns, one row per feature
+   * @param features direct index (may be null)
+   * @param direct_level levels above the leaves of the direct index nodes
+   */
+  void transform(const cv::Mat &descriptors, BowVector &bow,
+                 FeatureVector *features = nullptr,
+                 int direct_level = 4) const {
+    bow.clear();
+    if (features) features->clear();
+    if (empty() || descriptors.rows == 0) return;
+    check(descriptors);
+
+    const int direct_depth = std::max(0, _params.levels - direct_level);
+    std::vector<std::pair<uint32_t, int>> nodes;
+    if (features) nodes.reserve(size_t(descriptors.rows));
+    bow.reserve(size_t(descriptors.rows));
+    for (int r = 0; r < descriptors.rows; r++) {
+      uint32_t direct = 0;
+      const uint32_t n =
+          leaf(descriptor(descriptors.ptr<uint8_t>(r)), direct_depth, &direct);
+      if (_nodes[n].weight > 0) {
+        bow.emplace_back(_nodes[n].word, _nodes[n].weight);
+      }
+      if (features) nodes.emplace_back(direct, r);
+    }
+
+    // tf-idf: the weights of repeated words add up, then L1 normalisation
+    std::sort(bow.begin(), bow.end());
+    size_t out = 0;
+    double norm = 0;
+    for (size_t i = 0; i < bow.size(); i++) {
+      if (out > 0 && bow[out - 1].first == bow[i].first) {
+        bow[out - 1].second += bow[i].second;
+      } else {
+        bow[out++] = bow[i];
+      }
+      norm += bow[i].second;
+    }
+    bow.resize(out);
+    if (norm > 0) {
+      for (auto &entry : bow) entry.second = float(entry.second / norm);
+    }
+
+    if (features) {
+      std::sort(nodes.begin(), nodes.end());
+      for (const auto &entry : nodes) {
+        if (features->empty() || features->back().first != entry.first) {
+          features->emplace_back(entry.first, std::vector<int>());
+        }
+        features->back().second.push_back(entry.second);
+      }
+    }
+  }
+
+  /** L1 similarity of two normalised vectors, in [0, 1] */
+  static float score(const BowVector &a, const BowVector &b) {
+    float sum = 0;
+    auto i = a.begin(), j = b.begin();
+    while (i != a.end() && j != b.end()) {
+      if (i->first < j->first) {
+        ++i;
+      } else if (j->first < i->first) {
+        ++j;
+      } else {
+        sum += std::abs(i->second - j->second) - std::abs(i->second) -
+               std::abs(j->second);
+        ++i;
+        ++j;
+      }
+    }
+    return -sum / 2;
+  }
+
+  void save(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) throw std::runtime_error("Unable to open " + path);
+    const uint32_t header[] = {kMagic, kVersion, uint32_t(_params.k),
+                               uint32_t(_params.levels),
+                               uint32_t(_nodes.size())};
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    for (const auto &node : _nodes) {
+      out.write(reinterpret_cast<const char *>(&node.first_child), 4);
+      out.write(reinterpret_cast<const char *>(&node.num_children), 1);
+      out.write(reinterpret_cast<const char *>(&node.weight), 4);
+      out.write(reinterpret_cast<const char *>(node.centre.bits), kBytes);
+    }
+    if (!out) throw std::runtime_error("Unable to write " + path);
+  }
+
+  void load(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Unable to open " + path);
+    uint32_t header[5];
+    in.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (!in || header[0] != kMagic || header[1] != kVersion) {
+      throw std::runtime_error("Invalid vocabulary file " + path);
+    }
+    _params.k = int(header[2]);
+    _params.levels = int(header[3]);
+    _nodes.resize(header[4]);
+    _words.clear();
+    for (uint32_t n = 0; n < _nodes.size(); n++) {
+      Node &node = _nodes[n];
+      in.read(reinterpret_cast<char *>(&node.first_child), 4);
+      in.read(reinterpret_cast<char *>(&node.num_children), 1);
+      in.read(reinterpret_cast<char *>(&node.weight), 4);
+      in.read(reinterpret_cast<char *>(node.centre.bits), kBytes);
+      if (node.num_children > 0 &&
+          size_t(node.first_child) + node.num_children > _nodes.size()) {
+        in.setstate(std::ios::failbit);
+      }
+      node.word = kNone;
+      if (node.num_children == 0 && n > 0) {
+        node.word = uint32_t(_words.size());
+        _words.push_back(n);
+      }
+    }
+    if (!in) throw std::runtime_error("Invalid vocabulary file " + path);
+  }
+
+ private:
+  static constexpr uint32_t kMagic = 0x434F5642;  // "BVOC"
+  static constexpr uint32_t kVersion = 1;
+  static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+  /** children are contiguous: first_child .. first_child + num_children - 1 */
+  struct Node {
+    Descriptor centre{};
+    uint32_t first_child = 0;
+    uint8_t num_children = 0;
+    // idf of a word
+    float weight = 0;
+    uint32_t word = kNone;
+  };
+
+  static void check(const cv::Mat &descriptors) {
+    if (descriptors.type() != CV_8U || descriptors.cols != kBytes) {
+      throw std::invalid_argument("Descriptors must be CV_8U with 32 columns");
+    }
+  }
+
+  /**
+   * leaf of a descriptor
+   * @param direct set to the node at direct_depth on the way (or the leaf)
+   */
+  uint32_t leaf(const Descriptor &d, int direct_depth = 0,
+                uint32_t *direct = nullptr) const {
+    uint32_t n = 0;
+    for (int depth = 0;; depth++) {
+      if (direct && depth <= direct_depth) *direct = n;
+      const Node &node = _nodes[n];
+      if (node.num_children == 0) return n;
+      uint32_t best = node.first_child;
+      int best_distance = std::numeric_limits<int>::max();
+      for (uint32_t c = node.first_child;
+           c < node.first_child + node.num_children; c++) {
+        const int dist = distance(d, _nodes[c].centre);
+        if (dist < best_distance) {
+          best_distance = dist;
+          best = c;
+        }
+      }
+      n = best;
+    }
+  }
+
+  /** bitwise majority of the descriptors */
+  static Descriptor majority(const std::vector<Descriptor> &descriptors,
+                             const std::vector<uint32_t> &members) {
+    int counts[kBytes * 8] = {};
+    for (uint32_t i : members) {
+      for (int b = 0; b < kBytes * 8; b++) {
+        counts[b] += int((descriptors[i].bits[b / 64] >> (b % 64)) & 1);
+      }
+    }
+    Descriptor centre{};
+    for (int b = 0; b < kBytes * 8; b++) {
+      if (2 * size_t(counts[b]) > members.size()) {
+        centre.bits[b / 64] |= uint64_t(1) << (b % 64);
+      }
+    }
+    return centre;
+  }
+
+  /** k-majority split of a node's descriptors, recursively */
+  void cluster(uint32_t parent, const std::vector<Descriptor> &descriptors,
+               const std::vector<uint32_t> &indices, int depth,
+               std::mt19937 &engine) {
+    const size_t k = size_t(_params.k);
+    std::vector<Descriptor> centres;
+    std::vector<std::vector<uint32_t>> members;
+    if (indices.size() <= k) {
+      // one cluster per descriptor
+      for (uint32_t i : indices) {
+        centres.push_back(descriptors[i]);
+        members.push_back({i});
+      }
+    } else {
+      seed(descriptors, indices, engine, centres);
+      std::vector<uint32_t> assignment(indices.size(), kNone);
+      for (int iteration = 0; iteration < _params.max_iterations;
+           iteration++) {
+        bool changed = false;
+        for (size_t i = 0; i < indices.size(); i++) {
+          uint32_t best = 0;
+          int best_distance = std::numeric_limits<int>::max();
+          for (uint32_t c = 0; c < centres.size(); c++) {
+            const int dist = distance(descriptors[indices[i]], centres[c]);
+            if (dist < best_distance) {
+              best_distance = dist;
+              best = c;
+            }
+          }
+          changed |= assignment[i] != best;
+          assignment[i] = best;
+        }
+        members.assign(centres.size(), {});
+        for (size_t i = 0; i < indices.size(); i++) {
+          members[assignment[i]].push_back(indices[i]);
+        }
+        if (!changed) break;
+        for (size_t c = 0; c < centres.size(); c++) {
+          if (!members[c].empty()) {
+            centres[c] = majority(descriptors, members[c]);
+          }
+        }
+      }
+      // drop empty clusters
+      size_t out = 0;
+      for (size_t c = 0; c < centres.size(); c++) {
+        if (members[c].empty()) continue;
+        if (out != c) {
+          centres[out] = centres[c];
+          members[out] = std::move(members[c]);
+        }
+        out++;
+      }
+      centres.resize(out);
+      members.resize(out);
+    }
+
+    const uint32_t first = uint32_t(_nodes.size());
+    _nodes[parent].first_child = first;
+    _nodes[parent].num_children = uint8_t(centres.size());
+    for (const auto &centre : centres) {
+      _nodes.push_back(Node());
+      _nodes.back().centre = centre;
+    }
+    if (depth >= _params.levels) return;
+    for (size_t c = 0; c < centres.size(); c++) {
+      if (members[c].size() > 1) {
+        cluster(first + uint32_t(c), descriptors, members[c], depth + 1,
+                engine);
+      }
+    }
+  }
+
+  /** k-means++ seeds: each next seed with probability ~ squared distance */
+  void seed(const std::vector<Descriptor> &descriptors,
+            const std::vector<uint32_t> &indices, std::mt19937 &engine,
+            std::vector<Descriptor> &centres) const {
+    std::uniform_int_distribution<size_t> first(0, indices.size() - 1);
+    centres.assign(1, descriptors[indices[first(engine)]]);
+    std::vector<double> sq_distances(indices.size(),
+                                     std::numeric_limits<double>::max());
+    while (centres.size() < size_t(_params.k)) {
+      double total = 0;
+      for (size_t i = 0; i < indices.size(); i++) {
+        const double d = distance(descriptors[indices[i]], centres.back());
+        sq_distances[i] = std::min(sq_distances[i], d * d);
+        total += sq_distances[i];
+      }
+      if (total <= 0) break;
+      double target =
+          std::uniform_real_distribution<double>(0, total)(engine);
+      size_t i = 0;
+      while (i + 1 < indices.size() && target >= sq_distances[i]) {
+        target -= sq_distances[i++];
+      }
+      centres.push_back(descriptors[indices[i]]);
+    }
+  }
+
+  Params _params;
+  std::vector<Node> _nodes;
+  // node of each word
+  std::vector<uint32_t> _words;
+};
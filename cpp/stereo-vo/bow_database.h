@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "binary_vocabulary.h"
+#include "opencv2/core/core.hpp"
+
+/**
+ * Image database over a BinaryVocabulary.
+ *
+ * The inverted index lists, for every word, the entries containing it with
+ * their weights, so a query only visits the entries that share a word with
+ * it and accumulates their L1 scores there (cost independent of the entries
+ * without common words). The direct index of every entry is kept for
+ * match(), which compares only the features that fall into the same
+ * vocabulary node.
+ *
+ * query() uses member scratch buffers (no allocation per query) and is not
+ * thread-safe.
+ */
+class BowDatabase {
+ public:
+  using BowVector = BinaryVocabulary::BowVector;
+  using FeatureVector = BinaryVocabulary::FeatureVector;
+
+  struct Result {
+    int entry;
+    // L1 similarity in [0, 1]
+    float score;
+  };
+
+  explicit BowDatabase(const BinaryVocabulary &vocabulary)
+      : _inverted(vocabulary.num_words()) {}
+
+  size_t size() const { return _bows.size(); }
+  const BowVector &bow(int entry) const { return _bows[size_t(entry)]; }
+  const FeatureVector &features(int entry) const {
+    return _features[size_t(entry)];
+  }
+
+  /** @return id of the new entry */
+  int add(const BowVector &bow, const FeatureVector &features = {}) {
+    const int entry = int(_bows.size());
+    for (const auto &word : bow) {
+      if (word.first < _inverted.size()) {
+        _inverted[word.first].emplace_back(entry, word.second);
+      }
+    }
+    _bows.push_back(bow);
+    _features.push_back(features);
+    return entry;
+  }
+
+  /**
+   * best entries by L1 score, highest first
+   * @param max_entry only entries below this are returned (-1: all), e.g.
+   *                  to leave out the latest frames
+   */
+  void query(const BowVector &bow, std::vector<Result> &results,
+             size_t max_results, int max_entry = -1) const {
+    results.clear();
+    const size_t limit = max_entry < 0
+                             ? _bows.size()
+                             : std::min(_bows.size(), size_t(max_entry));
+    _scores.resize(_bows.size(), 0);
+    _touched.clear();
+
+    // sum over the common words of |v - w| - |v| - |w| (= -2 * similarity)
+    for (const auto &word : bow) {
+      if (word.first >= _inverted.size()) continue;
+      const float v = word.second;
+      for (const auto &posting : _inverted[word.first]) {
+        if (size_t(posting.first) >= limit) break;
+        const float w = posting.second;
+        float &score = _scores[size_t(posting.first)];
+        // every common word lowers the score below 0
+        if (score >= 0) _touched.push_back(posting.first);
+        score += std::abs(v - w) - std::abs(v) - std::abs(w);
+      }
+    }
+
+    for (int entry : _touched) {
+      results.push_back({entry, -_scores[size_t(entry)] / 2});
+      _scores[size_t(entry)] = 0;
+    }
+    const size_t n = std::min(max_results, results.size());
+    std::partial_sort(results.begin(), results.begin() + long(n),
+                      results.end(), [](const Result &a, const Result &b) {
+                        return a.score > b.score ||
+                               (!(b.score > a.score) && a.entry < b.entry);
+                      });
+    results.resize(n);
+  }
+
+  /**
+   * nearest-neighbour matches between two images, searched only among the
+   * features of the same direct-index node
+   * @param max_distance Hamming distance of accepted matches
+   * @param ratio best / second best distance must be below this
+   */
+  static void match(const cv::Mat &descriptors_a,
+                    const FeatureVector &features_a,
+                    const cv::Mat &descriptors_b,
+                    const FeatureVector &features_b,
+                    std::vector<cv::DMatch> &matches, int max_distance = 50,
+                    float ratio = 0.8f) {
+    matches.clear();
+    auto a = features_a.begin(), b = features_b.begin();
+    while (a != features_a.end() && b != features_b.end()) {
+      if (a->first < b->first) {
+        ++a;
+        continue;
+      }
+      if (b->first < a->first) {
+        ++b;
+        continue;
+      }
+      for (int i : a->second) {
+        const auto da =
+            BinaryVocabulary::descriptor(descriptors_a.ptr<uint8_t>(i));
+        int best = -1, best_distance = std::numeric_limits<int>::max(),
+            second_distance = std::numeric_limits<int>::max();
+        for (int j : b->second) {
+          const int d = BinaryVocabulary::distance(
+              da, BinaryVocabulary::descriptor(descriptors_b.ptr<uint8_t>(j)));
+          if (d < best_distance) {
+            second_distance = best_distance;
+            best_distance = d;
+            best = j;
+          } else if (d < second_distance) {
+            second_distance = d;
+          }
+        }
+        if (best >= 0 && best_distance <= max_distance &&
+            float(best_distance) < ratio * float(second_distance)) {
+          matches.emplace_back(i, best, float(best_distance));
+        }
+      }
+      ++a;
+      ++b;
+    }
+  }
+
+ private:
+  // word -> (entry, weight), entries in increasing order
+  std::vector<std::vector<std::pair<int, float>>> _inverted;
+  std::vector<BowVector> _bows;
+  std::vector<FeatureVector> _features;
+  // scratch of query()
+  mutable std::vector<float> _scores;
+  mutable std::vector<int> _touched;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "binary_vocabulary.h"
+#include "bow_database.h"
+#include "opencv2/core/core.hpp"
+#include "opencv2/features2d.hpp"
+#include "profiler.h"
+
+/**
+ * Loop detection over keyframes by bag of binary words.
+ *
+ * Every keyframe_interval-th frame gets ORB features, which are converted
+ * to a TF-IDF vector and direct index by the vocabulary and queried against
+ * the earlier keyframes (except the latest ones) through the inverted
+ * index. The best score is normalised by the score against the previous
+ * keyframe, which is what a revisit is expected to reach; a candidate above
+ * min_score is accepted if enough of its features match, searched through
+ * the direct index only.
+ */
+class PlaceRecognition {
+ public:
+  struct Params {
+    int features = 1000;
+    // frames between keyframes
+    int keyframe_interval = 5;
+    // the latest keyframes are not loop candidates
+    int exclude_recent = 10;
+    // candidates verified by feature matching
+    size_t candidates = 5;
+    // score over the score against the previous keyframe
+    float min_score = 0.3f;
+    int min_matches = 50;
+    // levels above the leaves of the direct index nodes
+    int direct_level = 4;
+  };
+
+  struct Loop {
+    int frame_id = -1;
+    // matched frame, -1 if there is no loop
+    int match_id = -1;
+    float score = 0;
+    int matches = 0;
+  };
+
+  PlaceRecognition(const std::string &vocabulary_path, const Params &params)
+      : _params(params), _database(load(vocabulary_path, _vocabulary)) {
+    _orb = cv::ORB::create(params.features);
+  }
+
+  size_t num_keyframes() const { return _database.size(); }
+
+  /**
+   * @param frame_id stored with the keyframe and reported in loops
+   * @return true if the frame closes a loop
+   */
+  bool process(const cv::Mat &gray, int frame_id, Loop &loop) {
+    loop = Loop();
+    loop.frame_id = frame_id;
+    if (_num_frames++ % _params.keyframe_interval != 0) return false;
+
+    UTILS_PROFILE_SCOPE("place-recognition");
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+    {
+      UTILS_PROFILE_SCOPE("orb");
+      _orb->detectAndCompute(gray, cv::noArray(), keypoints, descriptors);
+    }
+    BowDatabase::BowVector bow;
+    BowDatabase::FeatureVector features;
+    _vocabulary.transform(descriptors, bow, &features, _params.direct_level);
+
+    const int num_entries = int(_database.size());
+    const float reference =
+        num_entries > 0
+            ? BinaryVocabulary::score(bow, _database.bow(num_entries - 1))
+            : 0.f;
+    if (reference > 0 && num_entries > _params.exclude_recent) {
+      _database.query(bow, _results, _params.candidates,
+                      num_entries - _params.exclude_recent);
+      for (const auto &result : _results) {
+        if (result.score < _params.min_score * reference) break;
+        BowDatabase::match(descriptors, features,
+                           _descriptors[size_t(result.entry)],
+                           _database.features(result.entry), _matches);
+        if (int(_matches.size()) >= _params.min_matches) {
+          loop.match_id = _frame_ids[size_t(result.entry)];
+          loop.score = result.score / reference;
+          loop.matches = int(_matches.size());
+          break;
+        }
+      }
+    }
+
+    _database.add(bow, features);
+    _descriptors.push_back(descriptors);
+    _frame_ids.push_back(frame_id);
+    return loop.match_id >= 0;
+  }
+
+ private:
+  static const BinaryVocabulary &load(const std::string &path,
+                                      BinaryVocabulary &vocabulary) {
+    vocabulary.load(path);
+    return vocabulary;
+  }
+
+  Params _params;
+  BinaryVocabulary _vocabulary;
+  BowDatabase _database;
+  cv::Ptr<cv::ORB> _orb;
+  int _num_frames = 0;
+  // keyframe descriptors and frame ids by database entry
+  std::vector<cv::Mat> _descriptors;
+  std::vector<int> _frame_ids;
+  // buffers reused between keyframes
+  std::vector<BowDatabase::Result> _results;
+  std::vector<cv::DMatch> _matches;
+};
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+
+/**
+ * Semi-global matching on census costs.
+ *
+ * - 9x7 census transform, Hamming distance of the signatures as the
+ *   matching cost (0..62)
+ * - 4 aggregation paths over int16 costs with SIMD (AVX2 when built with
+ *   -march=native): left-right and right-left on row-parallel passes,
+ *   top-bottom and bottom-top on column-strip-parallel passes
+ * - winner-takes-all with uniqueness test, parabolic sub-pixel refinement
+ *   and left-right consistency check
+ *
+ * Only the region of interest is matched, and every row may limit the
+ * searched disparities (an empty range skips the row, e.g. sky rows).
+ * The output has the format of cv::StereoSGBM: CV_16S with 4 fractional
+ * bits, (min_disparity - 1) * 16 where no disparity was found.
+ */
+class SgmMatcher {
+ public:
+  struct Params {
+    // >= 0 (right pixels are searched left of the left pixel only)
+    int min_disparity = 0;
+    // multiple of 16
+    int num_disparities = 96;
+    // penalties of disparity changes by 1 and by more than 1 (in units of
+    // census bits)
+    int P1 = 10;
+    int P2 = 120;
+    int uniqueness_ratio = 10;
+    // maximum left-right difference (pixels), < 0 disables the check
+    int disp12_max_diff = 1;
+    // matched region of the left image (empty for the whole image)
+    cv::Rect roi;
+    // disparities [start, end) searched in each image row (empty for the
+    // full range; rows with an empty range are skipped)
+    std::vector<cv::Range> row_disparities;
+  };
+
+  explicit SgmMatcher(const Params &params) : _params(params) {
+    CV_Assert(params.min_disparity >= 0);
+    CV_Assert(params.num_disparities > 0 && params.num_disparities % 16 == 0);
+    // 4 paths of at most kMaxCost + P2 each must fit the int16 sum
+    CV_Assert(0 < params.P1 && params.P1 < params.P2 &&
+              4 * (kMaxCost + params.P2) < SHRT_MAX);
+  }
+
+  const Params &params() const { return _params; }
+
+  /**
+   * @param left left image (CV_8U)
+   * @param right right image (CV_8U), rectified with the left one
+   * @param disparity fixed-point disparity (CV_16S, 4 fractional bits)
+   */
+  void compute(const cv::Mat &left, const cv::Mat &right,
+               cv::Mat &disparity) {
+    CV_Assert(left.type() == CV_8U && right.type() == CV_8U &&
+              left.size() == right.size());
+    const cv::Rect image(cv::Point(), left.size());
+    _roi = _params.roi.empty() ? image : _params.roi & image;
+    disparity.create(left.size(), CV_16S);
+    disparity.setTo(invalid());
+    if (_roi.empty()) return;
+    prepare(left.cols);
+
+    census(left, _census_left);
+    census(right, _census_right);
+    cv::parallel_for_(cv::Range(0, _roi.height), [&](const cv::Range &range) {
+      horizontal_paths(range);
+    });
+    const int strips = (_roi.width + kStripWidth - 1) / kStripWidth;
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range) {
+      vertical_paths(range);
+    });
+    cv::parallel_for_(cv::Range(0, _roi.height), [&](const cv::Range &range) {
+      select(range, disparity);
+    });
+  }
+
+ private:
+  static constexpr int kRadiusX = 4, kRadiusY = 3;
+  static constexpr int kMaxCost = (2 * kRadiusX + 1) * (2 * kRadiusY + 1) - 1;
+  // path cost of disparities outside the searched range; + P2 must not
+  // overflow
+  static constexpr int16_t kLarge = 0x3fff;
+  static constexpr int kStripWidth = 16;
+
+  short invalid() const { return short((_params.min_disparity - 1) * 16); }
+
+  size_t index(int y, int x) const {
+    return (size_t(y) * size_t(_roi.width) + size_t(x)) *
+           size_t(_params.num_disparities);
+  }
+
+  void prepare(int cols) {
+    const int D = _params.num_disparities;
+    const size_t volume = size_t(_roi.area()) * size_t(D);
+    _cols = cols;
+    _cost.resize(volume);
+    _sum.resize(volume);
+    _census_left.resize(size_t(_roi.height) * size_t(cols));
+    _census_right.resize(size_t(_roi.height) * size_t(cols));
+
+    // searched disparity indices [start, end) of every ROI row
+    _ranges.resize(size_t(_roi.height));
+    for (int y = 0; y < _roi.height; y++) {
+      const int v = _roi.y + y;
+      cv::Range range(0, D);
+      if (size_t(v) < _params.row_disparities.size()) {
+        const cv::Range &row = _params.row_disparities[size_t(v)];
+        range.start = std::max(row.start - _params.min_disparity, 0);
+        range.end = std::min(row.end - _params.min_disparity, D);
+      }
+      _ranges[size_t(y)] = range.start < range.end ? range : cv::Range(0, 0);
+    }
+  }
+
+  /** census signatures of the ROI rows (all columns) */
+  void census(const cv::Mat &image, std::vector<uint64_t> &signatures) const {
+    const int cols = image.cols;
+    cv::parallel_for_(cv::Range(0, _roi.height), [&](const cv::Range &range) {
+      for (int y = range.start; y < range.end; y++) {
+        const int v = _roi.y + y;
+        uint64_t *out = &signatures[size_t(y) * size_t(cols)];
+        std::fill(out, out + cols, 0);
+        const uchar *centre = image.ptr<uchar>(v);
+        for (int dy = -kRadiusY; dy <= kRadiusY; dy++) {
+          // rows are clamped at the image border
+          const uchar *row = image.ptr<uchar>(
+              std::min(std::max(v + dy, 0), image.rows - 1));
+          for (int dx = -kRadiusX; dx <= kRadiusX; dx++) {
+            if (dy == 0 && dx == 0) continue;
+            // columns at the border keep a zero signature
+            for (int u = kRadiusX; u < cols - kRadiusX; u++) {
+              out[u] = (out[u] << 1) | uint64_t(row[u + dx] > centre[u]);
+            }
+          }
+        }
+      }
+    });
+  }
+
+  /** Hamming costs of one ROI row */
+  void row_costs(int y, const cv::Range &range) {
+    const uint64_t *left = &_census_left[size_t(y) * size_t(_cols)];
+    const uint64_t *right = &_census_right[size_t(y) * size_t(_cols)];
+    for (int x = 0; x < _roi.width; x++) {
+      const int u = _roi.x + x;
+      uint8_t *cost = &_cost[index(y, x)];
+      for (int k = range.start; k < range.end; k++) {
+        const int u_right = u - _params.min_disparity - k;
+        cost[k] = u_right < 0 ? uint8_t(kMaxCost)
+                              : uint8_t(__builtin_popcountll(
+                                    left[u] ^ right[u_right]));
+      }
+    }
+  }
+
+  /**
+   * path cost of one pixel
+   *   L(d) = C(d) + min(L'(d), L'(d -+ 1) + P1, min L' + P2) - min L'
+   * @param prev L' of the previous pixel on the path, padded by one element
+   * on both sides (kLarge outside its range)
+   * @param assign write the sum instead of accumulating into it
+   * @return min L
+   */
+  int16_t aggregate(const uint8_t *cost, const int16_t *prev, int16_t min_prev,
+                    int16_t *curr, int16_t *sum, const cv::Range &range,
+                    bool assign) const {
+    const short P1 = short(_params.P1);
+    const short min_p2 = short(min_prev + _params.P2);
+    int16_t min_curr = SHRT_MAX;
+    int k = range.start;
+#if CV_SIMD
+    const int lanes = cv::v_int16::nlanes;
+    const cv::v_int16 v_p1 = cv::vx_setall_s16(P1);
+    const cv::v_int16 v_min_p2 = cv::vx_setall_s16(min_p2);
+    const cv::v_int16 v_min_prev = cv::vx_setall_s16(min_prev);
+    cv::v_int16 v_min = cv::vx_setall_s16(SHRT_MAX);
+    for (; k + lanes <= range.end; k += lanes) {
+      const cv::v_int16 c =
+          cv::v_reinterpret_as_s16(cv::vx_load_expand(cost + k));
+      const cv::v_int16 p = cv::vx_load(prev + k);
+      const cv::v_int16 p_left = cv::vx_load(prev + k - 1);
+      const cv::v_int16 p_right = cv::vx_load(prev + k + 1);
+      const cv::v_int16 l =
+          c + (cv::v_min(cv::v_min(p, v_min_p2),
+                         cv::v_min(p_left, p_right) + v_p1) -
+               v_min_prev);
+      cv::v_store(curr + k, l);
+      cv::v_store(sum + k, assign ? l : cv::vx_load(sum + k) + l);
+      v_min = cv::v_min(v_min, l);
+    }
+    min_curr = cv::v_reduce_min(v_min);
+#endif
+    for (; k < range.end; k++) {
+      const int best = std::min(
+          {int(prev[k]), std::min(prev[k - 1], prev[k + 1]) + P1, int(min_p2)});
+      const int16_t l = int16_t(cost[k] + best - min_prev);
+      curr[k] = l;
+      sum[k] = assign ? l : int16_t(std::min(sum[k] + l, SHRT_MAX));
+      min_curr = std::min(min_curr, l);
+    }
+    return min_curr;
+  }
+
+  /**
+   * L' of one path: two padded buffers swapped from pixel to pixel; entries
+   * outside the last written range hold kLarge
+   */
+  struct PathBuffer {
+    std::vector<int16_t> buffers[2];
+    cv::Range written[2];
+    int current = 0;
+    int16_t min_prev = kLarge;
+
+    void reset(int D) {
+      for (int i = 0; i < 2; i++) {
+        buffers[i].assign(size_t(D + 2), kLarge);
+        written[i] = cv::Range(0, 0);
+      }
+      min_prev = kLarge;
+    }
+    const int16_t *prev() const { return &buffers[1 - current][1]; }
+    /** buffer for the next pixel, cleared to kLarge if the range changes */
+    int16_t *next(const cv::Range &range) {
+      if (written[current] != range) {
+        std::fill(buffers[current].begin(), buffers[current].end(), kLarge);
+        written[current] = range;
+      }
+      return &buffers[current][1];
+    }
+    void advance(int16_t min_curr) {
+      min_prev = min_curr;
+      current = 1 - current;
+    }
+  };
+
+  /** costs of the rows, then the left-right and right-left paths */
+  void horizontal_paths(const cv::Range &rows) {
+    const int D = _params.num_disparities;
+    PathBuffer path;
+    for (int y = rows.start; y < rows.end; y++) {
+      const cv::Range &range = _ranges[size_t(y)];
+      if (range.empty()) continue;
+      row_costs(y, range);
+
+      path.reset(D);
+      for (int x = 0; x < _roi.width; x++) {
+        const size_t i = index(y, x);
+        path.advance(aggregate(&_cost[i], path.prev(), path.min_prev,
+                               path.next(range), &_sum[i], range, true));
+      }
+      path.reset(D);
+      for (int x = _roi.width - 1; x >= 0; x--) {
+        const size_t i = index(y, x);
+        path.advance(aggregate(&_cost[i], path.prev(), path.min_prev,
+                               path.next(range), &_sum[i], range, false));
+      }
+    }
+  }
+
+  /** top-bottom and bottom-top paths of column strips */
+  void vertical_paths(const cv::Range &strips) {
+    const int D = _params.num_disparities;
+    std::vector<PathBuffer> paths(kStripWidth);
+    for (int strip = strips.start; strip < strips.end; strip++) {
+      const int x0 = strip * kStripWidth;
+      const int x1 = std::min(x0 + kStripWidth, _roi.width);
+      for (int direction = 0; direction < 2; direction++) {
+        for (auto &path : paths) path.reset(D);
+        for (int step = 0; step < _roi.height; step++) {
+          const int y = direction == 0 ? step : _roi.height - 1 - step;
+          const cv::Range &range = _ranges[size_t(y)];
+          for (int x = x0; x < x1; x++) {
+            PathBuffer &path = paths[size_t(x - x0)];
+            if (range.empty()) {
+              // skipped rows break the paths
+              path.reset(D);
+              continue;
+            }
+            const size_t i = index(y, x);
+            path.advance(aggregate(&_cost[i], path.prev(), path.min_prev,
+                                   path.next(range), &_sum[i], range, false));
+          }
+        }
+      }
+    }
+  }
+
+  /** winner-takes-all, sub-pixel refinement and left-right check */
+  void select(const cv::Range &rows, cv::Mat &disparity) const {
+    const int min_d = _params.min_disparity;
+    const int width = _roi.width;
+    // best left disparity of every right pixel (ROI columns)
+    std::vector<int> right_cost(static_cast<size_t>(width));
+    std::vector<int> right_disparity(static_cast<size_t>(width));
+    for (int y = rows.start; y < rows.end; y++) {
+      const cv::Range &range = _ranges[size_t(y)];
+      if (range.empty()) continue;
+      short *out = disparity.ptr<short>(_roi.y + y) + _roi.x;
+      std::fill(right_cost.begin(), right_cost.end(), INT_MAX);
+      std::fill(right_disparity.begin(), right_disparity.end(), -1);
+
+      for (int x = 0; x < width; x++) {
+        const int16_t *sum = &_sum[index(y, x)];
+        int best = range.start;
+        for (int k = range.start; k < range.end; k++) {
+          if (sum[k] < sum[best]) best = k;
+          const int x_right = x - min_d - k;
+          if (0 <= x_right && sum[k] < right_cost[size_t(x_right)]) {
+            right_cost[size_t(x_right)] = sum[k];
+            right_disparity[size_t(x_right)] = k + min_d;
+          }
+        }
+
+        const int min_sum = sum[best];
+        bool unique = true;
+        for (int k = range.start; k < range.end && unique; k++) {
+          unique = std::abs(k - best) <= 1 ||
+                   sum[k] * (100 - _params.uniqueness_ratio) >= min_sum * 100;
+        }
+        if (!unique) continue;
+
+        int d = (best + min_d) * 16;
+        if (range.start < best && best < range.end - 1) {
+          const int denominator =
+              std::max(sum[best - 1] + sum[best + 1] - 2 * min_sum, 1);
+          d += ((sum[best - 1] - sum[best + 1]) * 16 + denominator) /
+               (denominator * 2);
+        }
+        out[x] = short(d);
+      }
+
+      if (_params.disp12_max_diff < 0) continue;
+      for (int x = 0; x < width; x++) {
+        const int d = out[x];
+        if (d == invalid()) continue;
+        // both integer neighbours of the sub-pixel disparity must disagree
+        const int d_floor = d >> 4, d_ceil = (d + 15) >> 4;
+        const int x_floor = x - d_floor, x_ceil = x - d_ceil;
+        if (0 <= x_floor && right_disparity[size_t(x_floor)] >= min_d &&
+            std::abs(right_disparity[size_t(x_floor)] - d_floor) >
+                _params.disp12_max_diff &&
+            0 <= x_ceil && right_disparity[size_t(x_ceil)] >= min_d &&
+            std::abs(right_disparity[size_t(x_ceil)] - d_ceil) >
+                _params.disp12_max_diff) {
+          out[x] = invalid();
+        }
+      }
+    }
+  }
+
+  Params _params;
+  cv::Rect _roi;
+  int _cols = 0;
+  std::vector<cv::Range> _ranges;
+  std::vector<uint64_t> _census_left, _census_right;
+  std::vector<uint8_t> _cost;
+  std::vector<int16_t> _sum;
+};
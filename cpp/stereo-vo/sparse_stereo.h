@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+
+/**
+ * Stereo matching at given left-image points only.
+ *
+ * For each point the rectified epipolar row of the right image is searched
+ * over the disparity range with a patch cost, either SAD or census (Hamming
+ * distance of the census signatures over the patch). Costs of 16 disparities
+ * are evaluated at once with 128-bit SIMD, the winner has to pass a
+ * uniqueness test, and a parabola through the neighbouring costs gives the
+ * sub-pixel disparity. The work grows with the number of points, not with
+ * the image size.
+ */
+class SparseStereoMatcher {
+ public:
+  enum class Cost { SAD, Census };
+
+  struct Params {
+    // disparities [min_disparity, min_disparity + num_disparities) are
+    // searched (same meaning as StereoSGBM)
+    int min_disparity = 0;
+    int num_disparities = 96;
+    // patch of (2 * radius + 1)^2 pixels
+    int radius = 3;
+    Cost cost = Cost::Census;
+    // the best cost must beat the second best (outside +-1) by this margin (%)
+    int uniqueness_ratio = 10;
+  };
+
+  SparseStereoMatcher() : SparseStereoMatcher(Params()) {}
+  explicit SparseStereoMatcher(const Params &params) : _params(params) {}
+
+  const Params &params() const { return _params; }
+
+  /**
+   * @param left left image (CV_8U)
+   * @param right right image (CV_8U), rectified with the left one
+   * @param points pixels of the left image
+   * @param disparities sub-pixel disparity of every point, or -1 where no
+   * unique match was found (output)
+   */
+  void match(const cv::Mat &left, const cv::Mat &right,
+             const std::vector<cv::Point2f> &points,
+             std::vector<float> &disparities) const {
+    CV_Assert(left.type() == CV_8U && right.type() == CV_8U &&
+              left.size() == right.size());
+    disparities.resize(points.size());
+    cv::parallel_for_(
+        cv::Range(0, int(points.size())),
+        [&](const cv::Range &range) {
+          Buffers buffers;
+          for (int i = range.start; i < range.end; i++) {
+            disparities[size_t(i)] =
+                match_point(left, right, points[size_t(i)], buffers);
+          }
+        },
+        // a few points per task; each costs only microseconds
+        double(points.size()) / 64);
+  }
+
+ private:
+  static constexpr int kLanes = 16;
+  static constexpr uint16_t kInvalid = std::numeric_limits<uint16_t>::max();
+
+  struct Buffers {
+    // left patch and right strip, zero padded to whole SIMD blocks
+    std::vector<uint8_t> patch, strip;
+    std::vector<uint16_t> costs;
+  };
+
+  /**
+   * candidate k compares the left patch at u with the right patch at
+   * x = u - max_d + k, i.e. disparity d = max_d - k
+   */
+  float match_point(const cv::Mat &left, const cv::Mat &right,
+                    const cv::Point2f &point, Buffers &buffers) const {
+    const int r = _params.radius, size = 2 * r + 1;
+    const int u = cvRound(point.x), v = cvRound(point.y);
+    if (u - r < 0 || u + r >= left.cols || v - r < 0 || v + r >= left.rows) {
+      return -1;
+    }
+
+    const int min_d = _params.min_disparity;
+    const int max_d = min_d + _params.num_disparities - 1;
+    const int num = _params.num_disparities;
+    const int blocks = (num + kLanes - 1) / kLanes;
+    // strip columns: x - r for the first candidate to x + r for the last one
+    const int strip_cols = blocks * kLanes + 2 * r;
+    const int x0 = u - max_d - r;
+
+    buffers.patch.resize(size_t(size * size));
+    buffers.strip.assign(size_t(size * strip_cols), 0);
+    buffers.costs.resize(size_t(blocks * kLanes));
+    for (int dy = 0; dy < size; dy++) {
+      const uint8_t *left_row = left.ptr<uint8_t>(v - r + dy);
+      const uint8_t *right_row = right.ptr<uint8_t>(v - r + dy);
+      std::copy(left_row + u - r, left_row + u + r + 1,
+                &buffers.patch[size_t(dy * size)]);
+      const int begin = std::max(x0, 0);
+      const int end = std::min(x0 + strip_cols, right.cols);
+      if (begin < end) {
+        std::copy(right_row + begin, right_row + end,
+                  &buffers.strip[size_t(dy * strip_cols + begin - x0)]);
+      }
+    }
+
+    for (int block = 0; block < blocks; block++) {
+      uint16_t *costs = &buffers.costs[size_t(block * kLanes)];
+      if (_params.cost == Cost::SAD) {
+        sad_block(buffers, block * kLanes, strip_cols, costs);
+      } else {
+        census_block(buffers, block * kLanes, strip_cols, costs);
+      }
+    }
+    // candidates whose right patch leaves the image
+    for (int k = 0; k < num; k++) {
+      const int x = u - max_d + k;
+      if (x - r < 0 || x + r >= right.cols) buffers.costs[size_t(k)] = kInvalid;
+    }
+
+    return select(buffers.costs.data(), num, max_d);
+  }
+
+  /** SAD of the patch against 16 consecutive candidates */
+  void sad_block(const Buffers &buffers, int first, int strip_cols,
+                 uint16_t *costs) const {
+    const int size = 2 * _params.radius + 1;
+#if CV_SIMD128
+    cv::v_uint16x8 sum_lo = cv::v_setzero_u16(), sum_hi = cv::v_setzero_u16();
+    for (int dy = 0; dy < size; dy++) {
+      for (int dx = 0; dx < size; dx++) {
+        const cv::v_uint8x16 l =
+            cv::v_setall_u8(buffers.patch[size_t(dy * size + dx)]);
+        const cv::v_uint8x16 r = cv::v_load(
+            &buffers.strip[size_t(dy * strip_cols + first + dx)]);
+        cv::v_uint16x8 lo, hi;
+        cv::v_expand(cv::v_absdiff(l, r), lo, hi);
+        sum_lo += lo;
+        sum_hi += hi;
+      }
+    }
+    cv::v_store(costs, sum_lo);
+    cv::v_store(costs + 8, sum_hi);
+#else
+    for (int k = 0; k < kLanes; k++) {
+      int sum = 0;
+      for (int dy = 0; dy < size; dy++) {
+        for (int dx = 0; dx < size; dx++) {
+          sum += std::abs(int(buffers.patch[size_t(dy * size + dx)]) -
+                          int(buffers.strip[size_t(dy * strip_cols + first +
+                                                   k + dx)]));
+        }
+      }
+      costs[k] = uint16_t(sum);
+    }
+#endif
+  }
+
+  /**
+   * census cost against 16 consecutive candidates: for every neighbour of
+   * the centre, count the candidates whose comparison with their centre
+   * differs from the left patch
+   */
+  void census_block(const Buffers &buffers, int first, int strip_cols,
+                    uint16_t *costs) const {
+    const int r = _params.radius, size = 2 * r + 1;
+    const uint8_t left_centre = buffers.patch[size_t(r * size + r)];
+#if CV_SIMD128
+    // at most 255 neighbours fit the 8-bit counters (radius <= 7)
+    CV_Assert(size * size - 1 <= 255);
+    const cv::v_uint8x16 centre =
+        cv::v_load(&buffers.strip[size_t(r * strip_cols + first + r)]);
+    const cv::v_uint8x16 one = cv::v_setall_u8(1);
+    cv::v_uint8x16 count = cv::v_setzero_u8();
+    for (int dy = 0; dy < size; dy++) {
+      for (int dx = 0; dx < size; dx++) {
+        if (dy == r && dx == r) continue;
+        const cv::v_uint8x16 left_bit = cv::v_setall_u8(
+            buffers.patch[size_t(dy * size + dx)] > left_centre ? 1 : 0);
+        const cv::v_uint8x16 neighbour = cv::v_load(
+            &buffers.strip[size_t(dy * strip_cols + first + dx)]);
+        // comparison masks are 0xff / 0x00; keep one bit
+        const cv::v_uint8x16 right_bit = (neighbour > centre) & one;
+        count += right_bit ^ left_bit;
+      }
+    }
+    cv::v_uint16x8 lo, hi;
+    cv::v_expand(count, lo, hi);
+    cv::v_store(costs, lo);
+    cv::v_store(costs + 8, hi);
+#else
+    for (int k = 0; k < kLanes; k++) {
+      const uint8_t centre =
+          buffers.strip[size_t(r * strip_cols + first + k + r)];
+      int count = 0;
+      for (int dy = 0; dy < size; dy++) {
+        for (int dx = 0; dx < size; dx++) {
+          const bool left_bit =
+              buffers.patch[size_t(dy * size + dx)] > left_centre;
+          const bool right_bit =
+              buffers.strip[size_t(dy * strip_cols + first + k + dx)] > centre;
+          count += left_bit != right_bit;
+        }
+      }
+      costs[k] = uint16_t(count);
+    }
+#endif
+  }
+
+  /**
+   * winner-takes-all with uniqueness test and parabolic refinement
+   * @return sub-pixel disparity or -1
+   */
+  float select(const uint16_t *costs, int num, int max_d) const {
+    int best = -1;
+    for (int k = 0; k < num; k++) {
+      if (costs[k] != kInvalid && (best < 0 || costs[k] < costs[best])) {
+        best = k;
+      }
+    }
+    if (best < 0) return -1;
+
+    for (int k = 0; k < num; k++) {
+      if (std::abs(k - best) <= 1 || costs[k] == kInvalid) continue;
+      if (costs[k] * 100 <= costs[best] * (100 + _params.uniqueness_ratio)) {
+        return -1;
+      }
+    }
+
+    float offset = 0;
+    if (best > 0 && best < num - 1 && costs[best - 1] != kInvalid &&
+        costs[best + 1] != kInvalid) {
+      const float c_prev = costs[best - 1], c = costs[best],
+                  c_next = costs[best + 1];
+      const float denominator = c_prev - 2 * c + c_next;
+      if (denominator > 0) offset = 0.5f * (c_prev - c_next) / denominator;
+    }
+    // candidate k has disparity max_d - k
+    return float(max_d - best) - offset;
+  }
+
+  Params _params;
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "opencv2/calib3d/calib3d.hpp"
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+#include "sgm_matcher.h"
+
+/**
+ * Dense stereo: SGBM disparity and disparity-to-3D projection.
+ *
+ * The disparity comes from cv::StereoSGBM or, with census_sgm, from the
+ * census SGM engine (SgmMatcher), which shares the disparity range,
+ * uniqueness ratio and left-right check settings.
+ *
+ * Projection follows python/stereo_vo/stereo.py pixel2point:
+ *   x = (u - cx) / fx, y = (v - cy) / fy, depth = -P[0,3] / disparity
+ *   point = (x * depth, depth, -y * depth)
+ * (right, forward, up). to_points() runs row-parallel with SIMD arithmetic
+ * and the disparity_min/max filter fused into the same pass.
+ */
+class StereoMatcher {
+ public:
+  /** StereoSGBM settings and disparity range of python/stereo_vo/config.py */
+  struct Params {
+    int min_disparity = 0;
+    int num_disparities = 96;
+    int block_size = 9;
+    int P1 = 8 * 9 * 9;
+    int P2 = 32 * 9 * 9;
+    int disp12_max_diff = 1;
+    int pre_filter_cap = 63;
+    int uniqueness_ratio = 10;
+    int speckle_window_size = 100;
+    int speckle_range = 32;
+    // the parallel variant of SGBM (config.py leaves the mode at its default)
+    int mode = cv::StereoSGBM::MODE_SGBM_3WAY;
+
+    // SgmMatcher instead of cv::StereoSGBM; its penalties, ROI and per-row
+    // disparity ranges are set in sgm
+    bool census_sgm = false;
+    SgmMatcher::Params sgm;
+
+    // disparities kept as 3D points (pixels)
+    float disparity_min = 10;
+    float disparity_max = 96;
+  };
+
+  /** 3D point with the intensity of its pixel in [0, 1] */
+  struct Point {
+    float x, y, z, intensity;
+  };
+
+  /**
+   * @param projection 3x4 projection matrix of the right camera (calib.txt
+   * P1), whose P[0,3] = -fx * baseline
+   */
+  StereoMatcher(const Params &params, const cv::Matx34d &projection)
+      : _params(params),
+        _fx(projection(0, 0)),
+        _fy(projection(1, 1)),
+        _cx(projection(0, 2)),
+        _cy(projection(1, 2)),
+        _fx_baseline(-projection(0, 3)),
+        _census(census_params(params)) {
+    _sgbm = cv::StereoSGBM::create(
+        params.min_disparity, params.num_disparities, params.block_size,
+        params.P1, params.P2, params.disp12_max_diff, params.pre_filter_cap,
+        params.uniqueness_ratio, params.speckle_window_size,
+        params.speckle_range, params.mode);
+  }
+
+  const Params &params() const { return _params; }
+
+  /**
+   * compute the disparity of the left image
+   * @param disparity fixed-point disparity (CV_16S, 4 fractional bits)
+   */
+  void compute(const cv::Mat &left, const cv::Mat &right,
+               cv::Mat &disparity) {
+    if (_params.census_sgm) {
+      _census.compute(left, right, disparity);
+    } else {
+      _sgbm->compute(left, right, disparity);
+    }
+  }
+
+  /** disparity at a pixel in pixels (<= 0 if unknown) */
+  static float disparity_at(const cv::Mat &disparity,
+                            const cv::Point2f &pixel) {
+    const int u = cvRound(pixel.x), v = cvRound(pixel.y);
+    if (u < 0 || v < 0 || u >= disparity.cols || v >= disparity.rows) return 0;
+    return float(disparity.at<short>(v, u)) * (1.f / 16);
+  }
+
+  /** true if the disparity passes the disparity_min/max filter */
+  bool is_valid(float disparity) const {
+    return _params.disparity_min <= disparity &&
+           disparity <= _params.disparity_max;
+  }
+
+  /** 3D point of a pixel in the left camera frame (x right, y down, z ahead) */
+  cv::Point3f camera_point(const cv::Point2f &pixel, float disparity) const {
+    const float depth = float(_fx_baseline) / disparity;
+    return cv::Point3f(float((pixel.x - _cx) / _fx) * depth,
+                       float((pixel.y - _cy) / _fy) * depth, depth);
+  }
+
+  /**
+   * point cloud of every pixel whose disparity passes the filter
+   * @param disparity output of compute()
+   * @param image left image (CV_8U) for the intensities
+   * @param points output, reused between frames
+   */
+  void to_points(const cv::Mat &disparity, const cv::Mat &image,
+                 std::vector<Point> &points) {
+    CV_Assert(disparity.type() == CV_16S && image.type() == CV_8U &&
+              disparity.size() == image.size());
+    const int rows = disparity.rows, cols = disparity.cols;
+    prepare(rows, cols);
+
+    // pass 1 (per row): project and filter into the row's slice of _scratch
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+      std::vector<float> depth(size_t(cols));
+      for (int v = range.start; v < range.end; v++) {
+        _row_counts[size_t(v)] =
+            project_row(disparity.ptr<short>(v), image.ptr<uchar>(v), v, cols,
+                        depth.data(), &_scratch[size_t(v) * size_t(cols)]);
+      }
+    });
+
+    // pass 2: concatenate the rows
+    size_t total = 0;
+    for (int v = 0; v < rows; v++) {
+      _row_offsets[size_t(v)] = total;
+      total += _row_counts[size_t(v)];
+    }
+    points.resize(total);
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+      for (int v = range.start; v < range.end; v++) {
+        const Point *row = &_scratch[size_t(v) * size_t(cols)];
+        std::copy(row, row + _row_counts[size_t(v)],
+                  points.begin() + std::ptrdiff_t(_row_offsets[size_t(v)]));
+      }
+    });
+  }
+
+ private:
+  static SgmMatcher::Params census_params(const Params &params) {
+    SgmMatcher::Params census = params.sgm;
+    census.min_disparity = params.min_disparity;
+    census.num_disparities = params.num_disparities;
+    census.uniqueness_ratio = params.uniqueness_ratio;
+    census.disp12_max_diff = params.disp12_max_diff;
+    return census;
+  }
+
+  void prepare(int rows, int cols) {
+    if (int(_ray_x.size()) != cols) {
+      // per-column (u - cx) / fx, shared by every row
+      _ray_x.resize(size_t(cols));
+      for (int u = 0; u < cols; u++) {
+        _ray_x[size_t(u)] = float((u - _cx) / _fx);
+      }
+    }
+    _scratch.resize(size_t(rows) * size_t(cols));
+    _row_counts.resize(size_t(rows));
+    _row_offsets.resize(size_t(rows));
+  }
+
+  /**
+   * depth of every column (NaN where filtered out), then the compacted points
+   * @return number of points written to out
+   */
+  size_t project_row(const short *disparity, const uchar *intensity, int v,
+                     int cols, float *depth, Point *out) const {
+    const float scale = 1.f / 16;
+    const float d_min = _params.disparity_min, d_max = _params.disparity_max;
+    const float fx_baseline = float(_fx_baseline);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    int u = 0;
+#if CV_SIMD
+    const int lanes = cv::v_float32::nlanes;
+    const cv::v_float32 v_scale = cv::vx_setall_f32(scale);
+    const cv::v_float32 v_min = cv::vx_setall_f32(d_min);
+    const cv::v_float32 v_max = cv::vx_setall_f32(d_max);
+    const cv::v_float32 v_fb = cv::vx_setall_f32(fx_baseline);
+    const cv::v_float32 v_nan = cv::vx_setall_f32(nan);
+    for (; u + 2 * lanes <= cols; u += 2 * lanes) {
+      cv::v_int32 lo, hi;
+      cv::v_expand(cv::vx_load(disparity + u), lo, hi);
+      const cv::v_float32 d_lo = cv::v_cvt_f32(lo) * v_scale;
+      const cv::v_float32 d_hi = cv::v_cvt_f32(hi) * v_scale;
+      cv::v_store(depth + u, cv::v_select((d_lo >= v_min) & (d_lo <= v_max),
+                                          v_fb / d_lo, v_nan));
+      cv::v_store(depth + u + lanes,
+                  cv::v_select((d_hi >= v_min) & (d_hi <= v_max), v_fb / d_hi,
+                               v_nan));
+    }
+#endif
+    for (; u < cols; u++) {
+      const float d = float(disparity[u]) * scale;
+      depth[u] = (d_min <= d && d <= d_max) ? fx_baseline / d : nan;
+    }
+
+    // compaction; y is shared by the whole row
+    const float ray_y = float((v - _cy) / _fy);
+    size_t n = 0;
+    for (u = 0; u < cols; u++) {
+      const float z = depth[u];
+      if (std::isnan(z)) continue;
+      out[n++] = {_ray_x[size_t(u)] * z, z, -ray_y * z,
+                  float(intensity[u]) * (1.f / 255)};
+    }
+    return n;
+  }
+
+  Params _params;
+  double _fx, _fy, _cx, _cy, _fx_baseline;
+  cv::Ptr<cv::StereoSGBM> _sgbm;
+  SgmMatcher _census;
+
+  std::vector<float> _ray_x;
+  std::vector<Point> _scratch;
+  std::vector<size_t> _row_counts, _row_offsets;
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <future>
+#include <vector>
+
+#include "frame_pyramid.h"
+#include "grid_detector.h"
+#include "opencv2/calib3d/calib3d.hpp"
+#include "opencv2/core/core.hpp"
+#include "profiler.h"
+#include "sparse_stereo.h"
+#include "stereo_matcher.h"
+#include "track_store.h"
+#include "vo_features.h"
+
+/**
+ * Frame-to-frame stereo odometry.
+ *
+ * Features of the left image are tracked with LK into the next left image;
+ * their 3D positions come from the SGBM disparity of the previous pair, so
+ * the motion is a 3D-2D PnP RANSAC problem with metric scale. The disparity
+ * of the new pair is computed on a second thread while the tracks are
+ * followed, and the dense point cloud of the pair (StereoMatcher::to_points)
+ * is built once the disparity is ready.
+ *
+ * In sparse mode no disparity image is computed: the previous pair is
+ * matched (SparseStereoMatcher) only at the pixels of the tracks that
+ * survived into the current frame, which removes SGBM from the front-end
+ * and leaves no dense cloud.
+ */
+class StereoOdometry {
+ public:
+  struct Params {
+    StereoMatcher::Params stereo;
+    GridDetector::Params detector;
+    // tracks are replenished below this count
+    size_t min_tracks = 1000;
+    // PnP RANSAC
+    int ransac_iterations = 100;
+    float ransac_reprojection_error = 1.0f;
+    double ransac_confidence = 0.99;
+    // build the dense point cloud of every pair (dense mode only)
+    bool dense_cloud = true;
+    // match at the tracked features only instead of computing SGBM
+    bool sparse = false;
+    SparseStereoMatcher::Params sparse_stereo;
+  };
+
+  /**
+   * @param P0 projection matrix of the left camera (calib.txt P0)
+   * @param P1 projection matrix of the right camera (calib.txt P1)
+   */
+  StereoOdometry(const Params &params, const cv::Matx34d &P0,
+                 const cv::Matx34d &P1)
+      : _params(params),
+        _matcher(params.stereo, P1),
+        _sparse_matcher(params.sparse_stereo),
+        _detector(params.detector),
+        _K(P0(0, 0), 0, P0(0, 2), 0, P0(1, 1), P0(1, 2), 0, 0, 1),
+        _R(cv::Mat::eye(3, 3, CV_64F)),
+        _t(cv::Mat::zeros(3, 1, CV_64F)) {}
+
+  /**
+   * process the next stereo pair
+   * @param pyramid LK pyramid of the left image
+   * @param left left image (CV_8U)
+   * @param right right image (CV_8U)
+   * @return false if the motion could not be estimated (pose kept)
+   */
+  bool process(const FramePyramid &pyramid, const cv::Mat &left,
+               const cv::Mat &right) {
+    // disparity of the new pair, while the tracks are followed
+    std::future<void> disparity;
+    if (!_params.sparse) {
+      disparity = std::async(std::launch::async, [&] {
+        UTILS_PROFILE_SCOPE("disparity");
+        _matcher.compute(left, right, _disparity);
+      });
+    }
+
+    bool success = false;
+    if (!_prev_pyramid.empty()) {
+      {
+        UTILS_PROFILE_SCOPE("track");
+        featureTracking(_prev_pyramid, pyramid, _tracks);
+      }
+      success = estimate_motion();
+    }
+    if (disparity.valid()) disparity.get();
+
+    if (_params.dense_cloud && !_params.sparse) {
+      UTILS_PROFILE_SCOPE("cloud");
+      _matcher.to_points(_disparity, left, _cloud);
+    }
+
+    _tracks.advance();
+    if (_tracks.size() < _params.min_tracks) {
+      UTILS_PROFILE_SCOPE("detect");
+      if (_tracks.empty()) {
+        _detector.detect(left, _new_points);
+      } else {
+        _detector.replenish(left, _tracks.prev_points(), _new_points);
+      }
+      _tracks.add(_new_points);
+    }
+
+    _prev_pyramid = pyramid;
+    _prev_left = left;
+    _prev_right = right;
+    std::swap(_prev_disparity, _disparity);
+    return success;
+  }
+
+  /** orientation of the left camera (camera-to-world) */
+  const cv::Mat &R() const { return _R; }
+  /** position of the left camera */
+  const cv::Mat &t() const { return _t; }
+  /** inliers of the last PnP */
+  int num_inliers() const { return _num_inliers; }
+  const TrackStore &tracks() const { return _tracks; }
+  /** dense point cloud of the last pair (if enabled) */
+  const std::vector<StereoMatcher::Point> &cloud() const { return _cloud; }
+
+ private:
+  bool estimate_motion() {
+    UTILS_PROFILE_SCOPE("pnp");
+    // 3D points of the previous pair and their tracked pixels
+    _object_points.clear();
+    _image_points.clear();
+    const auto &prev = _tracks.prev_points();
+    const auto &curr = _tracks.curr_points();
+    if (_params.sparse) {
+      UTILS_PROFILE_SCOPE("stereo-match");
+      _sparse_matcher.match(_prev_left, _prev_right, prev, _disparities);
+    }
+    for (size_t i = 0; i < _tracks.size(); i++) {
+      const float d = _params.sparse ? _disparities[i]
+                                     : StereoMatcher::disparity_at(
+                                           _prev_disparity, prev[i]);
+      if (!_matcher.is_valid(d)) continue;
+      _object_points.push_back(_matcher.camera_point(prev[i], d));
+      _image_points.push_back(curr[i]);
+    }
+    _num_inliers = 0;
+    if (_object_points.size() < 6) return false;
+
+    // X_curr = R X_prev + t
+    cv::Mat rvec, tvec;
+    if (!cv::solvePnPRansac(_object_points, _image_points, _K, cv::noArray(),
+                            rvec, tvec, false, _params.ransac_iterations,
+                            _params.ransac_reprojection_error,
+                            _params.ransac_confidence, _inliers)) {
+      return false;
+    }
+    _num_inliers = int(_inliers.total());
+
+    cv::Mat R;
+    cv::Rodrigues(rvec, R);
+    // chain the inverse motion onto the camera-to-world pose
+    _t = _t - _R * R.t() * tvec;
+    _R = _R * R.t();
+    return true;
+  }
+
+  Params _params;
+  StereoMatcher _matcher;
+  SparseStereoMatcher _sparse_matcher;
+  GridDetector _detector;
+  const cv::Matx33d _K;
+
+  cv::Mat _R, _t;
+  int _num_inliers = 0;
+
+  TrackStore _tracks;
+  FramePyramid _prev_pyramid;
+  cv::Mat _disparity, _prev_disparity;
+  // previous pair, matched at the tracks in sparse mode
+  cv::Mat _prev_left, _prev_right;
+  std::vector<StereoMatcher::Point> _cloud;
+
+  // buffers reused between frames
+  std::vector<cv::Point2f> _new_points;
+  std::vector<float> _disparities;
+  std::vector<cv::Point3f> _object_points;
+  std::vector<cv::Point2f> _image_points;
+  cv::Mat _inliers;
+};
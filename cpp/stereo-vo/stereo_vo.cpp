@@ -0,0 +1,248 @@
+/**
+ * Stereo visual odometry on KITTI image_0 / image_1 pairs
+ * (C++ version of python/stereo_vo).
+ */
+#include <boost/format.hpp>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+
+#include "frame_source.h"
+#include "output_sink.h"
+#include "place_recognition.h"
+#include "profiler.h"
+#include "replay_options.h"
+#include "stereo_odometry.h"
+
+using namespace cv;
+using namespace std;
+
+// frames decoded ahead of tracking, and threads decoding each camera
+const size_t PREFETCH_FRAMES = 4;
+const size_t DECODE_THREADS = 1;
+// stereo matching at the tracked features only (no SGBM, no dense cloud)
+const bool SPARSE_STEREO = false;
+// census SGM engine instead of cv::StereoSGBM for the dense disparity
+const bool CENSUS_SGM = false;
+// also run both disparity engines on every pair and report both
+const bool COMPARE_STEREO_ENGINES = false;
+// BinaryVocabulary file (cpp/samples/bow_vocabulary); empty: no loop detection
+const string vocabulary_path = "";
+// loop closure candidates (frame, matched frame, score, matches)
+const string loop_path = "stereo_loops.txt";
+// per-stage latency report (<prefix>.json, .csv and .trace.json)
+const string profile_prefix = "profile_stereo";
+
+string image_path(const ReplayOptions &options, int camera, int frame_id) {
+  return (boost::format("%s/image_%d/%06d.png") % options.sequence_path() %
+          camera % frame_id)
+      .str();
+}
+
+/**
+ * running comparison of the census SGM engine against cv::StereoSGBM
+ */
+struct StereoEngineComparison {
+  int frames = 0;
+  double sgbm_secs = 0, census_secs = 0;
+  // share of the pixels with a disparity
+  double sgbm_valid = 0, census_valid = 0;
+  // sum of |census - SGBM| over the pixels valid in both (pixels)
+  double abs_diff = 0;
+  size_t common = 0;
+
+  void add(const Mat &sgbm, const Mat &census, int min_disparity) {
+    const short min_d = short(min_disparity * 16);
+    size_t sgbm_count = 0, census_count = 0;
+    for (int v = 0; v < sgbm.rows; v++) {
+      const short *a = sgbm.ptr<short>(v), *b = census.ptr<short>(v);
+      for (int u = 0; u < sgbm.cols; u++) {
+        sgbm_count += a[u] >= min_d;
+        census_count += b[u] >= min_d;
+        if (a[u] >= min_d && b[u] >= min_d) {
+          abs_diff += abs(a[u] - b[u]) / 16.0;
+          common++;
+        }
+      }
+    }
+    sgbm_valid += double(sgbm_count) / double(sgbm.total());
+    census_valid += double(census_count) / double(census.total());
+    frames++;
+  }
+
+  void print() const {
+    if (frames == 0) return;
+    cout << "Disparity over " << frames << " pairs: SGBM "
+         << 1e3 * sgbm_secs / frames << " ms, census SGM "
+         << 1e3 * census_secs / frames << " ms, valid pixels "
+         << sgbm_valid / frames << " / " << census_valid / frames
+         << ", mean |diff| on common pixels "
+         << abs_diff / double(max<size_t>(common, 1)) << " px" << endl;
+  }
+};
+
+/**
+ * projection matrices P0..P3 of the sequence (calib.txt)
+ */
+vector<Matx34d> read_calib(const string &path) {
+  ifstream in(path);
+  if (!in) throw runtime_error("Unable to open " + path);
+  vector<Matx34d> matrices;
+  string line;
+  while (getline(in, line)) {
+    istringstream fields(line);
+    string name;
+    Matx34d P;
+    fields >> name;
+    for (int i = 0; i < 12; i++) fields >> P.val[i];
+    if (!fields) continue;
+    matrices.push_back(P);
+  }
+  if (matrices.size() < 2) throw runtime_error("Invalid calib file " + path);
+  return matrices;
+}
+
+int main(int argc, char **argv) {
+  ReplayOptions options;
+  try {
+    options = ReplayOptions::parse(argc, argv);
+  } catch (const invalid_argument &e) {
+    cerr << e.what() << endl;
+    ReplayOptions::print_usage(cerr, argv[0]);
+    return 1;
+  }
+  if (options.help) {
+    ReplayOptions::print_usage(cout, argv[0]);
+    return 0;
+  }
+
+  utils::Profiler::instance().enable_trace();
+
+  const vector<Matx34d> calib =
+      read_calib(options.sequence_path() + "/calib.txt");
+  StereoOdometry::Params params;
+  params.sparse = SPARSE_STEREO;
+  params.stereo.census_sgm = CENSUS_SGM;
+  StereoOdometry odometry(params, calib[0], calib[1]);
+
+  // both engines with the settings of the odometry
+  StereoMatcher::Params sgbm_params = params.stereo;
+  StereoMatcher::Params census_params = params.stereo;
+  sgbm_params.census_sgm = false;
+  census_params.census_sgm = true;
+  StereoMatcher sgbm(sgbm_params, calib[1]), census(census_params, calib[1]);
+  StereoEngineComparison comparison;
+  Mat sgbm_disparity, census_disparity;
+  auto timed = [](double &secs, const function<void()> &run) {
+    const auto start = chrono::steady_clock::now();
+    run();
+    secs += chrono::duration<double>(chrono::steady_clock::now() - start)
+                .count();
+  };
+
+  OutputSink::Params sink_params;
+  sink_params.outputs.push_back(
+      {options.output, options.format, options.binary});
+  sink_params.view = !options.headless;
+  OutputSink sink(sink_params);
+  const vector<double> timestamps = options.timestamps();
+
+  // both cameras are decoded on background threads; the left pyramids are
+  // built there as well
+  FrameSource left_frames(
+      [&](int frame_id) { return image_path(options, 0, frame_id); },
+      options.first, options.last, PREFETCH_FRAMES, DECODE_THREADS, true);
+  FrameSource right_frames(
+      [&](int frame_id) { return image_path(options, 1, frame_id); },
+      options.first, options.last, PREFETCH_FRAMES, DECODE_THREADS, false);
+
+  // with --fps, frames arrive at a fixed rate like a live camera
+  FramePacer pacer(options.fps);
+  ReplayStats replay_stats;
+  replay_stats.latency_ms.reserve(size_t(options.last - options.first));
+  size_t cloud_points = 0;
+
+  unique_ptr<PlaceRecognition> place_recognition;
+  if (!vocabulary_path.empty()) {
+    place_recognition = make_unique<PlaceRecognition>(
+        vocabulary_path, PlaceRecognition::Params());
+  }
+  PlaceRecognition::Loop loop;
+  size_t num_loops = 0;
+  ofstream loops;
+  if (place_recognition) loops.open(loop_path);
+
+  const auto begin = chrono::steady_clock::now();
+  FrameSource::Frame left, right;
+  for (;;) {
+    const auto arrival = pacer.wait();
+    UTILS_PROFILE_SCOPE("frame");
+    {
+      UTILS_PROFILE_SCOPE("load");
+      if (!left_frames.next(left) || !right_frames.next(right)) break;
+    }
+
+    if (!odometry.process(left.pyramid, left.gray, right.gray) &&
+        left.id != options.first && !options.headless) {
+      sink.log("frame " + to_string(left.id) + ": motion not estimated");
+    }
+    cloud_points += odometry.cloud().size();
+
+    if (COMPARE_STEREO_ENGINES) {
+      timed(comparison.sgbm_secs,
+            [&] { sgbm.compute(left.gray, right.gray, sgbm_disparity); });
+      timed(comparison.census_secs, [&] {
+        census.compute(left.gray, right.gray, census_disparity);
+      });
+      comparison.add(sgbm_disparity, census_disparity,
+                     params.stereo.min_disparity);
+    }
+
+    if (place_recognition &&
+        place_recognition->process(left.gray, left.id, loop)) {
+      loops << loop.frame_id << " " << loop.match_id << " " << loop.score
+            << " " << loop.matches << "\n";
+      num_loops++;
+    }
+
+    {
+      UTILS_PROFILE_SCOPE("output");
+      sink.pose(left.id, timestamps[size_t(left.id)], odometry.R(),
+                odometry.t());
+      sink.image(left.color);
+    }
+
+    replay_stats.latency_ms.push_back(
+        chrono::duration<double, milli>(chrono::steady_clock::now() - arrival)
+            .count());
+  }
+
+  const double elapsed_secs =
+      chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  sink.close();
+  replay_stats.late_frames = pacer.late_frames();
+  replay_stats.print(elapsed_secs);
+  if (!SPARSE_STEREO && !replay_stats.latency_ms.empty()) {
+    cout << "Dense cloud: "
+         << cloud_points / replay_stats.latency_ms.size() << " points/frame"
+         << endl;
+  }
+
+  comparison.print();
+
+  utils::Profiler::instance().report();
+  utils::Profiler::instance().write_all(profile_prefix);
+
+  cout << "Trajectory written to " << options.output << endl;
+  if (place_recognition) {
+    cout << num_loops << " loop closures in "
+         << place_recognition->num_keyframes() << " keyframes written to "
+         << loop_path << endl;
+  }
+  cout << odometry.R() << endl;
+  cout << odometry.t() << endl;
+
+  return 0;
+}
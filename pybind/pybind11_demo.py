@@ -1,4 +1,6 @@
-from lib import mylibs
+import numpy as np
+
+from lib import clouds, mylibs
 
 
 def main():
@@ -20,5 +22,24 @@ def main():
     ]))
 
 
+def clouds_demo():
+    points = np.random.uniform(-50, 50, (100000, 4)).astype(np.float32)
+    cloud = clouds.PointCloud(points)
+
+    near = cloud.filter_range(1.0, 30.0)
+    print(len(cloud), "->", len(near), "points within 30 m")
+
+    # zero-copy view: (N, 3) columns of the x, y, z arrays
+    xyz = near.xyz
+    print(xyz.shape, xyz.strides, np.allclose(xyz.mean(axis=0), near.centroid()))
+
+    near.transform(np.eye(3), [0.0, 0.0, 1.0])
+    print("z after transform", xyz[:, 2].mean())
+
+    mean, covariance = near.covariance()
+    print(mean, covariance, sep="\n")
+
+
 if __name__ == "__main__":
     main()
+    clouds_demo()
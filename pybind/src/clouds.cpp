@@ -0,0 +1,68 @@
+#include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <stdexcept>
+
+#include "point_cloud.h"
+
+namespace py = pybind11;
+
+// (N, 3) or (N, 4) float32 配列 (x, y, z[, intensity]) からコピー
+PointCloud from_numpy(
+        py::array_t<float, py::array::c_style | py::array::forcecast> points) {
+    if (points.ndim() != 2 || (points.shape(1) != 3 && points.shape(1) != 4)) {
+        throw std::runtime_error("points must be (N, 3) or (N, 4)");
+    }
+    const size_t n = size_t(points.shape(0)), dims = size_t(points.shape(1));
+    const auto p = points.unchecked<2>();
+    PointCloud cloud(n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t a = 0; a < dims; a++) {
+            cloud.data(PointCloud::Attribute(a))[i] =
+                    p(py::ssize_t(i), py::ssize_t(a));
+        }
+        if (dims == 3) cloud.intensity()[i] = 0;
+    }
+    return cloud;
+}
+
+// 属性の行を列とする (N, k) のビュー (コピーなし). self が生きている間だけ有効
+py::array_t<float> view(py::object self, size_t columns) {
+    PointCloud &cloud = self.cast<PointCloud &>();
+    return py::array_t<float>({cloud.size(), columns},
+                              {sizeof(float), cloud.stride() * sizeof(float)},
+                              cloud.x(), self);
+}
+
+PYBIND11_MODULE(clouds, m) {
+    m.doc() = "structure-of-arrays point cloud (cpp/lidar-odometry/point_cloud.h)";
+
+    py::class_<PointCloud>(m, "PointCloud")
+            .def(py::init<>())
+            .def(py::init(&from_numpy))
+            .def("__len__", &PointCloud::size)
+            // numpy への書き込みはそのまま点群に反映される
+            .def_property_readonly("xyz", [](py::object self) { return view(self, 3); })
+            .def_property_readonly("xyzi", [](py::object self) { return view(self, 4); })
+            .def("filter_range", [](const PointCloud &cloud, float min_range,
+                                    float max_range) {
+                PointCloud out;
+                cloud.filter_range(min_range, max_range, out);
+                return out;
+            })
+            .def("crop_box", [](const PointCloud &cloud, const Eigen::Vector3f &min,
+                                const Eigen::Vector3f &max, bool negative) {
+                PointCloud out;
+                cloud.crop_box(min, max, out, negative);
+                return out;
+            }, py::arg("min"), py::arg("max"), py::arg("negative") = false)
+            .def("transform", &PointCloud::transform)
+            .def("centroid", &PointCloud::centroid)
+            .def("covariance", [](const PointCloud &cloud) {
+                Eigen::Vector3d mean;
+                Eigen::Matrix3d covariance;
+                cloud.covariance(mean, covariance);
+                return py::make_tuple(mean, covariance);
+            });
+}